@@ -9,15 +9,18 @@ MAKEFLAGS += --no-builtin-rules
 
 export ARCH ?= rm
 export BUILD ?= debug
+# stock = the puzzle library's malloc.c; stats = count allocations (alloc.cpp);
+# pool = size-class pools and phase arenas (alloc_pool.cpp)
+export ALLOCATOR ?= stock
 export BUILD_ROOT ?= build
-export BUILD_DIR ?= $(BUILD_ROOT)/$(BUILD)
+export BUILD_DIR ?= $(BUILD_ROOT)/$(BUILD)$(if $(filter-out stock,$(ALLOCATOR)),-$(ALLOCATOR))
 export RMP_COMPILE_DATE ?= $(shell date +%Y-%m-%d)
 export RMP_VERSION ?= $(shell git tag --sort v:refname \
 	| tail -n1 \
 	| perl -pe 's/(\d+)$$/($$1 + 1)."-SNAPSHOT"/e')
 
 
-DOCKER_ENV=-e ARCH -e BUILD -e BUILD_ROOT -e BUILD_DIR -e RMP_COMPILE_DATE -e RMP_VERSION
+DOCKER_ENV=-e ARCH -e BUILD -e ALLOCATOR -e BUILD_ROOT -e BUILD_DIR -e RMP_COMPILE_DATE -e RMP_VERSION
 
 ifeq ($(ARCH),rm)
 	CXX = arm-linux-gnueabihf-g++
@@ -39,6 +42,10 @@ else ifeq ($(BUILD),prof)
 	BUILD_FLAGS = -g -pg -O2 -DNDEBUG
 else ifeq ($(BUILD),icons)
 	BUILD_FLAGS = -DNDEBUG -DRMP_ICON_APP
+else ifeq ($(BUILD),bench)
+	BUILD_FLAGS = -O2 -DNDEBUG -DRMP_BENCH
+else ifeq ($(BUILD),render_check)
+	BUILD_FLAGS = -O2 -DNDEBUG -DRMP_RENDER_CHECK
 else ifeq ($(BUILD),resim)
 	BUILD_FLAGS = -g -UREMARKABLE -DDEV -DRESIM
 else
@@ -46,4 +53,10 @@ else
 	BUILD_FLAGS = -O2 -DNDEBUG
 endif
 
+ifeq ($(ALLOCATOR),stats)
+	ALLOC_FLAGS = -DRMP_ALLOC_STATS
+else ifeq ($(ALLOCATOR),pool)
+	ALLOC_FLAGS = -DRMP_ALLOC_POOL
+endif
+
 endif # include guard
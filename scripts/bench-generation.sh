@@ -0,0 +1,15 @@
+#!/usr/bin/env bash
+# Time generating every preset of every game, and flag presets that would be
+# too slow to generate on the device.
+#
+# Options (before any game names): --seeds N, --scale F, --limit MS
+set -eo pipefail
+
+# ALLOCATOR=pool (etc.) benchmarks another allocator against the stock one
+make bench
+
+dir=build/bench
+if [ -n "$ALLOCATOR" ] && [ "$ALLOCATOR" != stock ]; then
+    dir=$dir-$ALLOCATOR
+fi
+"$dir"/puzzles "$@"
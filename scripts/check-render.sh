@@ -0,0 +1,11 @@
+#!/usr/bin/env bash
+# Check every game's rendering against golden images and draw timings.
+#
+# The golden images and timings are tracked in tests/golden/. After an
+# intended rendering change, regenerate them and commit the result:
+#   scripts/check-render.sh --update
+set -eo pipefail
+
+make render_check
+
+build/render_check/puzzles "$@" vendor/puzzles/icons tests/golden
@@ -0,0 +1,188 @@
+#include "alloc.hpp"
+
+#ifdef RMP_ALLOC_STATS
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "paths.hpp"
+
+// Calls and bytes are counted for the phase that makes them (that's the
+// churn). Live bytes stay with the phase that allocated them, so its peak
+// is how much it held at once.
+struct AllocStats {
+    std::atomic<long> allocs { 0 };
+    std::atomic<long> reallocs { 0 };
+    std::atomic<long> frees { 0 };
+    std::atomic<long> bytes { 0 };
+    std::atomic<long> live { 0 };
+    std::atomic<long> peak { 0 };
+
+    void add_live(long delta)
+    {
+        long now = live += delta;
+        long prev = peak.load();
+        while (now > prev && !peak.compare_exchange_weak(prev, now)) { }
+    }
+};
+
+// Every allocation is prefixed with its size and owner
+union AllocHeader {
+    struct {
+        size_t size;
+        AllocStats * owner;
+    } info;
+    std::max_align_t align;
+};
+
+typedef std::pair<const game *, AllocPhase> AllocKey;
+
+static std::mutex & stats_mutex()
+{
+    static std::mutex m;
+    return m;
+}
+
+// std::map never moves its values, so pointers into it stay valid
+static std::map<AllocKey, AllocStats> & all_stats()
+{
+    static std::map<AllocKey, AllocStats> stats;
+    return stats;
+}
+
+static AllocStats & total_stats()
+{
+    static AllocStats stats;
+    return stats;
+}
+
+static AllocStats * find_stats(const game * g, AllocPhase phase)
+{
+    std::lock_guard<std::mutex> lock(stats_mutex());
+    return &all_stats()[AllocKey(g, phase)];
+}
+
+static std::vector<AllocStats *> & phase_stack()
+{
+    static thread_local std::vector<AllocStats *> stack;
+    return stack;
+}
+
+static AllocStats * current_stats()
+{
+    auto & stack = phase_stack();
+    if (!stack.empty())
+        return stack.back();
+    static AllocStats * other = find_stats(NULL, AllocPhase::OTHER);
+    return other;
+}
+
+static const auto stats_start = std::chrono::steady_clock::now();
+
+void alloc_phase_begin(const game * g, AllocPhase phase)
+{
+    phase_stack().push_back(find_stats(g, phase));
+}
+
+void alloc_phase_end()
+{
+    phase_stack().pop_back();
+}
+
+// -- Replacements for the library's malloc.c --
+
+void * smalloc(size_t size)
+{
+    auto * h = static_cast<AllocHeader *>(malloc(sizeof(AllocHeader) + size));
+    if (h == NULL)
+        fatal("out of memory");
+    AllocStats * s = current_stats();
+    h->info.size = size;
+    h->info.owner = s;
+    for (AllocStats * stats : { s, &total_stats() }) {
+        stats->allocs++;
+        stats->bytes += size;
+        stats->add_live(size);
+    }
+    return h + 1;
+}
+
+void sfree(void * p)
+{
+    if (p == NULL)
+        return;
+    auto * h = static_cast<AllocHeader *>(p) - 1;
+    current_stats()->frees++;
+    total_stats().frees++;
+    h->info.owner->add_live(-(long)h->info.size);
+    total_stats().add_live(-(long)h->info.size);
+    free(h);
+}
+
+void * srealloc(void * p, size_t size)
+{
+    if (p == NULL)
+        return smalloc(size);
+    auto * h = static_cast<AllocHeader *>(p) - 1;
+    long delta = (long)size - (long)h->info.size;
+    h = static_cast<AllocHeader *>(realloc(h, sizeof(AllocHeader) + size));
+    if (h == NULL)
+        fatal("out of memory");
+    h->info.size = size;
+    for (AllocStats * stats : { current_stats(), &total_stats() }) {
+        stats->reallocs++;
+        if (delta > 0)
+            stats->bytes += delta;
+    }
+    h->info.owner->add_live(delta);
+    total_stats().add_live(delta);
+    return h + 1;
+}
+
+// -- Reporting --
+
+static const char * PHASE_NAMES[] = {
+    "other", "generate", "move", "solve", "redraw", "serialise",
+};
+
+static void report_line(std::ostream & out, const std::string & name,
+                        const char * phase, const AllocStats & s, float secs)
+{
+    char line[200];
+    snprintf(line, sizeof(line), "%-10s %-9s %10ld %10ld %10ld %12ld %10ld %10ld %10.0f",
+             name.c_str(), phase, s.allocs.load(), s.reallocs.load(), s.frees.load(),
+             s.bytes.load(), s.live.load(), s.peak.load(),
+             secs > 0 ? (s.allocs + s.reallocs) / secs : 0);
+    out << line << std::endl;
+}
+
+void alloc_stats_report(std::ostream & out)
+{
+    float secs = std::chrono::duration<float>(
+            std::chrono::steady_clock::now() - stats_start).count();
+    char line[200];
+    snprintf(line, sizeof(line), "%-10s %-9s %10s %10s %10s %12s %10s %10s %10s",
+             "game", "phase", "allocs", "reallocs", "frees",
+             "bytes", "live", "peak", "calls/s");
+    out << line << std::endl;
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex());
+        for (auto & kv : all_stats()) {
+            const AllocStats & s = kv.second;
+            if (s.allocs == 0 && s.reallocs == 0 && s.frees == 0)
+                continue;
+            report_line(out, kv.first.first ? paths::game_basename(kv.first.first) : "-",
+                        PHASE_NAMES[(int)kv.first.second], s, secs);
+        }
+    }
+    report_line(out, "total", "-", total_stats(), secs);
+}
+
+#endif // RMP_ALLOC_STATS
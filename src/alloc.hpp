@@ -0,0 +1,52 @@
+#ifndef RMP_ALLOC_HPP
+#define RMP_ALLOC_HPP
+
+// Replacement allocators for the puzzle library.
+//
+// The library allocates everything through smalloc/srealloc/sfree, which
+// other ALLOCATOR builds replace:
+//
+//   stats: count calls, bytes, live bytes and the high-water mark for each
+//          game and phase (alloc.cpp)
+//   pool:  size-class pools, and arenas for phases whose allocations don't
+//          outlive them (alloc_pool.cpp)
+//
+// Code that calls into the midend says what it's doing with an AllocScope;
+// anything else counts as OTHER. Send the app SIGUSR1 for a report on stderr.
+//
+// In stock builds all of this compiles to nothing.
+
+#include <ostream>
+
+#include "puzzles.hpp"
+
+enum class AllocPhase {
+    OTHER,
+    GENERATE,
+    MOVE,
+    SOLVE,
+    REDRAW,
+    SERIALISE,
+    NUM_PHASES
+};
+
+#if defined(RMP_ALLOC_STATS) || defined(RMP_ALLOC_POOL)
+// Phases nest (e.g. a move redraws), per thread
+void alloc_phase_begin(const game * g, AllocPhase phase);
+void alloc_phase_end();
+void alloc_stats_report(std::ostream & out);
+#else
+inline void alloc_phase_begin(const game * g, AllocPhase phase) {}
+inline void alloc_phase_end() {}
+inline void alloc_stats_report(std::ostream & out) {}
+#endif
+
+class AllocScope {
+public:
+    AllocScope(const game * g, AllocPhase phase) { alloc_phase_begin(g, phase); }
+    ~AllocScope() { alloc_phase_end(); }
+    AllocScope(const AllocScope &) = delete;
+    AllocScope & operator=(const AllocScope &) = delete;
+};
+
+#endif // RMP_ALLOC_HPP
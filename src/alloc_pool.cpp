@@ -0,0 +1,289 @@
+#include "alloc.hpp"
+
+#ifdef RMP_ALLOC_POOL
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+// Pool allocator for the puzzle library, to keep the heap from fragmenting
+// over long sessions:
+//
+// - Allocations in phases whose garbage doesn't outlive them (generate,
+//   solve, redraw, serialise) are bumped from arena chunks. Each chunk
+//   counts its live allocations and is recycled as soon as that reaches
+//   zero, so an occasional survivor (a new game's state, say) pins one
+//   chunk rather than a whole phase.
+// - Anything else up to MAX_POOLED bytes comes from a size-class free list.
+//   Game states, move strings and drawstate arrays are mostly a handful of
+//   sizes per game, so freed blocks are quickly reused.
+// - Bigger allocations go to malloc.
+//
+// Pools and chunks are never returned to the system. One lock covers
+// everything; the solver and tool threads allocate too, but rarely contend.
+
+static const size_t CHUNK_SIZE = 64 * 1024;
+// Bigger arena allocations would waste too much of a chunk
+static const size_t MAX_ARENA = CHUNK_SIZE / 8;
+static const size_t CLASS_SIZES[] = { 16, 32, 48, 64, 96, 128, 192, 256, 384, 512 };
+static const int NUM_CLASSES = sizeof(CLASS_SIZES) / sizeof(CLASS_SIZES[0]);
+static const size_t MAX_POOLED = CLASS_SIZES[NUM_CLASSES - 1];
+
+enum BlockKind : uint32_t { POOLED, ARENA, LARGE };
+
+union ArenaChunk;
+
+// Precedes every allocation
+union BlockHeader {
+    struct {
+        BlockKind kind;
+        uint32_t size;    // requested size (LARGE, ARENA) or class (POOLED)
+        ArenaChunk * chunk;
+    } info;
+    std::max_align_t align;
+};
+
+struct FreeBlock {
+    FreeBlock * next;
+};
+
+union ArenaChunk {
+    struct {
+        ArenaChunk * next_free;
+        int phase;
+        size_t used;
+        long live;
+    } info;
+    std::max_align_t align;
+
+    char * data() { return reinterpret_cast<char *>(this + 1); }
+};
+static const size_t ARENA_CAPACITY = CHUNK_SIZE - sizeof(ArenaChunk);
+
+struct PoolStats {
+    long chunks = 0;
+    long arena_allocs = 0;
+    long arena_resets = 0;
+    long pooled_allocs = 0;
+    long pooled_reuses = 0;
+    long large_allocs = 0;
+};
+
+static std::mutex pool_mutex;
+static FreeBlock * free_lists[NUM_CLASSES];
+static char * pool_next[NUM_CLASSES];
+static char * pool_end[NUM_CLASSES];
+static ArenaChunk * arena_current[(int)AllocPhase::NUM_PHASES];
+static ArenaChunk * free_chunks;
+static PoolStats pool_stats;
+
+static thread_local std::vector<AllocPhase> phase_stack;
+
+static bool is_arena_phase(AllocPhase phase)
+{
+    return phase == AllocPhase::GENERATE || phase == AllocPhase::SOLVE
+        || phase == AllocPhase::REDRAW || phase == AllocPhase::SERIALISE;
+}
+
+static size_t align_up(size_t size)
+{
+    const size_t a = alignof(std::max_align_t);
+    return (size + a - 1) & ~(a - 1);
+}
+
+static int size_class(size_t size)
+{
+    for (int i = 0; i < NUM_CLASSES; i++)
+        if (size <= CLASS_SIZES[i])
+            return i;
+    return -1;
+}
+
+static void * new_chunk()
+{
+    void * p = malloc(CHUNK_SIZE);
+    if (p == NULL)
+        fatal("out of memory");
+    pool_stats.chunks++;
+    return p;
+}
+
+// -- All below are called with pool_mutex held --
+
+static BlockHeader * arena_alloc(AllocPhase phase, size_t size)
+{
+    size_t need = sizeof(BlockHeader) + align_up(size);
+    ArenaChunk *& chunk = arena_current[(int)phase];
+    if (chunk == NULL || chunk->info.used + need > ARENA_CAPACITY) {
+        // Retire the current chunk; whatever's still live in it will
+        // recycle it when it's freed
+        if (chunk != NULL && chunk->info.live == 0) {
+            chunk->info.next_free = free_chunks;
+            free_chunks = chunk;
+        }
+        if (free_chunks != NULL) {
+            chunk = free_chunks;
+            free_chunks = chunk->info.next_free;
+        } else {
+            chunk = static_cast<ArenaChunk *>(new_chunk());
+        }
+        chunk->info.phase = (int)phase;
+        chunk->info.used = 0;
+        chunk->info.live = 0;
+    }
+    auto * h = reinterpret_cast<BlockHeader *>(chunk->data() + chunk->info.used);
+    chunk->info.used += need;
+    chunk->info.live++;
+    h->info.kind = ARENA;
+    h->info.size = size;
+    h->info.chunk = chunk;
+    pool_stats.arena_allocs++;
+    return h;
+}
+
+static void arena_free(ArenaChunk * chunk)
+{
+    if (--chunk->info.live > 0)
+        return;
+    pool_stats.arena_resets++;
+    if (arena_current[chunk->info.phase] == chunk) {
+        chunk->info.used = 0; // nothing left in it: start again
+    } else {
+        chunk->info.next_free = free_chunks;
+        free_chunks = chunk;
+    }
+}
+
+static BlockHeader * pool_alloc(int cls)
+{
+    pool_stats.pooled_allocs++;
+    BlockHeader * h;
+    if (free_lists[cls] != NULL) {
+        pool_stats.pooled_reuses++;
+        h = reinterpret_cast<BlockHeader *>(free_lists[cls]);
+        free_lists[cls] = free_lists[cls]->next;
+    } else {
+        size_t block = sizeof(BlockHeader) + CLASS_SIZES[cls];
+        if (pool_next[cls] == NULL || pool_next[cls] + block > pool_end[cls]) {
+            pool_next[cls] = static_cast<char *>(new_chunk());
+            pool_end[cls] = pool_next[cls] + CHUNK_SIZE;
+        }
+        h = reinterpret_cast<BlockHeader *>(pool_next[cls]);
+        pool_next[cls] += block;
+    }
+    h->info.kind = POOLED;
+    h->info.size = cls;
+    h->info.chunk = NULL;
+    return h;
+}
+
+static void pool_free(BlockHeader * h)
+{
+    int cls = h->info.size;
+    auto * block = reinterpret_cast<FreeBlock *>(h);
+    block->next = free_lists[cls];
+    free_lists[cls] = block;
+}
+
+static size_t capacity(BlockHeader * h)
+{
+    return h->info.kind == POOLED ? CLASS_SIZES[h->info.size] : h->info.size;
+}
+
+void alloc_phase_begin(const game * g, AllocPhase phase)
+{
+    phase_stack.push_back(phase);
+}
+
+void alloc_phase_end()
+{
+    phase_stack.pop_back();
+}
+
+// -- Replacements for the library's malloc.c --
+
+void * smalloc(size_t size)
+{
+    AllocPhase phase = phase_stack.empty() ? AllocPhase::OTHER : phase_stack.back();
+    BlockHeader * h;
+    if (is_arena_phase(phase) && size <= MAX_ARENA) {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        h = arena_alloc(phase, size);
+    } else if (size <= MAX_POOLED) {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        h = pool_alloc(size_class(size));
+    } else {
+        h = static_cast<BlockHeader *>(malloc(sizeof(BlockHeader) + size));
+        if (h == NULL)
+            fatal("out of memory");
+        h->info.kind = LARGE;
+        h->info.size = size;
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        pool_stats.large_allocs++;
+    }
+    return h + 1;
+}
+
+void sfree(void * p)
+{
+    if (p == NULL)
+        return;
+    auto * h = static_cast<BlockHeader *>(p) - 1;
+    if (h->info.kind == LARGE) {
+        free(h);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    if (h->info.kind == ARENA)
+        arena_free(h->info.chunk);
+    else
+        pool_free(h);
+}
+
+void * srealloc(void * p, size_t size)
+{
+    if (p == NULL)
+        return smalloc(size);
+    auto * h = static_cast<BlockHeader *>(p) - 1;
+    size_t old_size = capacity(h);
+    if (size <= old_size && h->info.kind != LARGE)
+        return p;
+    if (h->info.kind == LARGE && size > MAX_POOLED) {
+        h = static_cast<BlockHeader *>(realloc(h, sizeof(BlockHeader) + size));
+        if (h == NULL)
+            fatal("out of memory");
+        h->info.size = size;
+        return h + 1;
+    }
+    void * q = smalloc(size);
+    memcpy(q, p, std::min(old_size, size));
+    sfree(p);
+    return q;
+}
+
+// -- Reporting --
+
+void alloc_stats_report(std::ostream & out)
+{
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    long free_count = 0;
+    for (ArenaChunk * c = free_chunks; c != NULL; c = c->info.next_free)
+        free_count++;
+    char line[300];
+    snprintf(line, sizeof(line),
+             "pool: %ld chunks (%ld KB), %ld free; "
+             "arena: %ld allocs, %ld resets; "
+             "pooled: %ld allocs, %ld reused; large: %ld",
+             pool_stats.chunks, pool_stats.chunks * (long)CHUNK_SIZE / 1024, free_count,
+             pool_stats.arena_allocs, pool_stats.arena_resets,
+             pool_stats.pooled_allocs, pool_stats.pooled_reuses,
+             pool_stats.large_allocs);
+    out << line << std::endl;
+}
+
+#endif // RMP_ALLOC_POOL
@@ -0,0 +1,174 @@
+// Standalone app to benchmark puzzle generation
+
+#ifndef RMP_BENCH_HPP
+#define RMP_BENCH_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+
+#include "alloc.hpp"
+#include "game_list.hpp"
+#include "paths.hpp"
+#include "puzzles.hpp"
+#include "worker.hpp"
+
+// Frontend without any drawing, just for generating games
+class BenchFrontend : public frontend {
+public:
+    BenchFrontend(const game * g)
+    {
+        ourgame = g;
+        me = midend_new(this, g, NULL, NULL);
+    }
+};
+
+// Times midend_new_game for every preset of every game, over many seeds:
+//
+//   bench [--seeds N] [--scale F] [--limit MS] [GAME...]
+//
+// Presets are benchmarked in parallel, one per thread. Device time is
+// estimated as host time * scale; to calibrate the scale, run the same
+// bench on the device (`make bench ARCH=rm`) with --scale 1 and compare.
+// Presets whose estimated p99 on the device is over the limit are flagged
+// as too slow for interactive use. p99 needs at least 100 seeds to be
+// anything other than the max.
+class BenchApp {
+public:
+    // Rough ratio of rM2 (Cortex-A7) to desktop x86 generation times
+    static constexpr float DEFAULT_DEVICE_SCALE = 8.0;
+    // Longest acceptable wait for a new game on the device
+    static const int DEFAULT_LIMIT_MS = 1000;
+    static const int DEFAULT_SEEDS = 100;
+
+    struct Result {
+        std::string game;
+        std::string preset;
+        std::vector<float> ms; // sorted
+    };
+
+    int seeds = DEFAULT_SEEDS;
+    float scale = DEFAULT_DEVICE_SCALE;
+    float limit_ms = DEFAULT_LIMIT_MS;
+    std::vector<std::string> only_games;
+
+    BenchApp(int argc, char *argv[])
+    {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--seeds" && i + 1 < argc)
+                seeds = std::max(1, atoi(argv[++i]));
+            else if (arg == "--scale" && i + 1 < argc)
+                scale = atof(argv[++i]);
+            else if (arg == "--limit" && i + 1 < argc)
+                limit_ms = atof(argv[++i]);
+            else
+                only_games.push_back(arg);
+        }
+    }
+
+    int run()
+    {
+        std::vector<Result> results;
+        std::mutex m;
+        {
+            WorkQueue queue(std::thread::hardware_concurrency());
+            for (auto * g : GAME_LIST) {
+                std::string name = paths::game_basename(g);
+                if (!only_games.empty() && std::find(only_games.begin(),
+                            only_games.end(), name) == only_games.end())
+                    continue;
+                BenchFrontend fe(g);
+                std::vector<std::pair<std::string, std::string>> presets;
+                get_presets(g, midend_get_presets(fe.me, NULL), "", presets);
+                for (auto & preset : presets) {
+                    queue.add([=, &results, &m]() {
+                        Result r = bench_preset(g, preset.first, preset.second);
+                        std::lock_guard<std::mutex> lock(m);
+                        results.push_back(r);
+                    });
+                }
+            }
+            queue.wait();
+        }
+
+        std::sort(results.begin(), results.end(), [](const Result & a, const Result & b) {
+            return a.game != b.game ? a.game < b.game : a.ms.back() < b.ms.back();
+        });
+        int slow = 0;
+        printf("%-10s %-40s %9s %9s %9s %9s %11s\n",
+               "game", "preset", "min", "median", "p99", "max", "device p99");
+        for (auto & r : results) {
+            // nearest rank: the smallest time that 99% of runs are within
+            size_t rank = (r.ms.size() * 99 + 99) / 100;
+            float p99 = r.ms[std::max<size_t>(rank, 1) - 1];
+            bool too_slow = p99 * scale > limit_ms;
+            slow += too_slow;
+            printf("%-10s %-40s %9.1f %9.1f %9.1f %9.1f %11.0f%s\n",
+                   r.game.c_str(), r.preset.c_str(),
+                   r.ms.front(), r.ms[r.ms.size() / 2], p99, r.ms.back(),
+                   p99 * scale, too_slow ? "  SLOW" : "");
+        }
+
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        printf("\npeak memory (all threads): %ld KB\n", usage.ru_maxrss);
+        printf("%d presets estimated over %.0f ms on the device\n", slow, limit_ms);
+        alloc_stats_report(std::cout);
+        return 0;
+    }
+
+protected:
+    // Flatten the preset menu into (title, encoded params) pairs
+    void get_presets(const game * g, struct preset_menu * menu, const std::string & prefix,
+                     std::vector<std::pair<std::string, std::string>> & out)
+    {
+        for (int i = 0; i < menu->n_entries; i++) {
+            auto & entry = menu->entries[i];
+            std::string title = prefix + entry.title;
+            if (entry.submenu != NULL) {
+                get_presets(g, entry.submenu, title + " / ", out);
+            } else {
+                char * params = g->encode_params(entry.params, true);
+                out.emplace_back(title, params);
+                sfree(params);
+            }
+        }
+    }
+
+    Result bench_preset(const game * g, const std::string & title, const std::string & params)
+    {
+        Result r;
+        r.game = paths::game_basename(g);
+        r.preset = title;
+        BenchFrontend fe(g);
+        for (int i = 0; i < seeds; i++) {
+            // params#seed fixes both, so runs are repeatable
+            std::string id = params + "#bench" + std::to_string(i);
+            const char * err = midend_game_id(fe.me, id.c_str());
+            if (err != NULL) {
+                std::cerr << r.game << " " << id << ": " << err << std::endl;
+                break;
+            }
+            auto start = std::chrono::steady_clock::now();
+            {
+                AllocScope scope(g, AllocPhase::GENERATE);
+                midend_new_game(fe.me);
+            }
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            r.ms.push_back(std::chrono::duration<float, std::milli>(elapsed).count());
+        }
+        if (r.ms.empty())
+            r.ms.push_back(0);
+        std::sort(r.ms.begin(), r.ms.end());
+        return r;
+    }
+};
+
+#endif // RMP_BENCH_HPP
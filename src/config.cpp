@@ -39,6 +39,24 @@ Config::Button parse_button(const char *value, Config::Button default_button)
     }
 }
 
+Config::Animation parse_animation(const char *value)
+{
+    Config::Animation ret;
+    if (strcmp(value, "full") == 0) {
+        ret.mode = Config::Animation::Mode::FULL;
+    } else if (strcmp(value, "skip") == 0) {
+        ret.mode = Config::Animation::Mode::SKIP;
+    } else if (strcmp(value, "final") == 0) {
+        ret.mode = Config::Animation::Mode::FINAL;
+    } else if (std::atoi(value) > 0) {
+        ret.mode = Config::Animation::Mode::FRAMES;
+        ret.frames = std::atoi(value);
+    } else {
+        std::cerr << "unexpected animation value: " << value << std::endl;
+    }
+    return ret;
+}
+
 int handler(void* user, const char* section, const char* name, const char* value)
 {
     Parser *p = static_cast<Parser*>(user);
@@ -72,11 +90,39 @@ int handler(void* user, const char* section, const char* name, const char* value
             std::cerr << "unexpected key: " << section << "." << name << std::endl;
             return 0;
         }
+    } else if (strcmp(section, "render") == 0) {
+        if (strcmp(name, "drag_overlay") == 0) {
+            p->cfg->drag_overlay = strcmp(value, "true") == 0;
+        } else if (strcmp(name, "bands") == 0) {
+            p->cfg->render_bands = std::atoi(value);
+        } else {
+            std::cerr << "unexpected key: " << section << "." << name << std::endl;
+            return 0;
+        }
+    } else if (strcmp(section, "solve") == 0) {
+        if (strcmp(name, "speculative") == 0) {
+            p->cfg->speculative_solve = strcmp(value, "true") == 0;
+        } else {
+            std::cerr << "unexpected key: " << section << "." << name << std::endl;
+            return 0;
+        }
+    } else if (strcmp(section, "animation") == 0) {
+        if (strcmp(name, "moves") == 0) {
+            p->cfg->move_animation = parse_animation(value);
+        } else if (strcmp(name, "flash") == 0) {
+            p->cfg->flash_animation = parse_animation(value);
+        } else {
+            std::cerr << "unexpected key: " << section << "." << name << std::endl;
+            return 0;
+        }
     } else if (strcmp(section, "full_refresh") == 0) {
         if (strcmp(name, "new_puzzle") == 0) {
             p->cfg->full_refresh_new = strcmp(value, "true") == 0;
         } else if (strcmp(name, "solving_puzzle") == 0) {
-            p->cfg->full_refresh_solving = strcmp(value, "true") == 0;
+            p->cfg->ghosting_budget = strcmp(value, "true") == 0
+                ? Config::DEFAULT_GHOSTING_BUDGET : 0;
+        } else if (strcmp(name, "ghosting_budget") == 0) {
+            p->cfg->ghosting_budget = std::atof(value);
         } else {
             std::cerr << "unexpected key: " << section << "." << name << std::endl;
             return 0;
@@ -23,9 +23,35 @@ struct Config {
     std::string long_press_help;
     std::string long_drag_help;
 
+    // rendering
+    bool drag_overlay = false; // see PuzzleDrawer
+    // Large frames are drawn in this many horizontal bands in parallel.
+    // 0 = one per core; 1 = draw everything on the UI thread.
+    int render_bands = 0;
+
+    // solving
+    // Solve in the background once the player is idle, so Solve is instant
+    bool speculative_solve = false;
+
+    // animations
+    struct Animation {
+        // FULL: draw every frame
+        // SKIP: no animation; draw the end state immediately
+        // FINAL: draw nothing until the animation would have finished
+        // FRAMES: only draw `frames` evenly spaced frames, then the end state
+        enum class Mode { FULL, SKIP, FINAL, FRAMES };
+        Mode mode = Mode::FULL;
+        int frames = 0;
+    };
+    Animation move_animation;
+    Animation flash_animation;
+
     // full refresh (to clear ghosting)
     bool full_refresh_new = false;
-    bool full_refresh_solving = false;
+    // While solving, only tiles that have changed this much since their last
+    // clean refresh are refreshed (see Canvas). 0 = never.
+    static constexpr float DEFAULT_GHOSTING_BUDGET = 2.0;
+    float ghosting_budget = 0;
 
     // colors
     std::vector<float> colors; // unset colors are -1
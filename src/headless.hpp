@@ -0,0 +1,110 @@
+#ifndef RMP_HEADLESS_HPP
+#define RMP_HEADLESS_HPP
+
+// In-memory display, for running the whole app with no screen and no device
+// (e.g. automated tests). Selected at runtime with --headless.
+
+#include <algorithm>
+#include <csignal>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <rmkit.h>
+
+// Framebuffer that never leaves memory. Every refresh request is counted,
+// along with the number of pixels it would have sent to the display, per
+// waveform mode.
+class HeadlessFB : public framebuffer::VirtualFB {
+public:
+    // rM2 screen size
+    static const int DEFAULT_WIDTH = 1404;
+    static const int DEFAULT_HEIGHT = 1872;
+
+    struct Counters {
+        long refreshes = 0;
+        long full_refreshes = 0;
+        long pixels = 0;
+    };
+    std::map<int, Counters> counters; // by waveform mode
+
+    HeadlessFB(int w = DEFAULT_WIDTH, int h = DEFAULT_HEIGHT)
+        : framebuffer::VirtualFB(w, h)
+    {
+    }
+
+    int perform_redraw(bool full_screen) override
+    {
+        Counters & c = counters[waveform_mode];
+        c.refreshes++;
+        if (full_screen || update_mode == UPDATE_MODE_FULL)
+            c.full_refreshes++;
+        if (full_screen) {
+            c.pixels += (long)width * height;
+        } else if (dirty_area.x1 > dirty_area.x0 && dirty_area.y1 > dirty_area.y0) {
+            int x0 = std::max(0, dirty_area.x0), x1 = std::min(width, dirty_area.x1);
+            int y0 = std::max(0, dirty_area.y0), y1 = std::min(height, dirty_area.y1);
+            if (x1 > x0 && y1 > y0)
+                c.pixels += (long)(x1 - x0) * (y1 - y0);
+        }
+        return ++marker;
+    }
+
+    void reset_counters() { counters.clear(); }
+
+    Counters total() const
+    {
+        Counters ret;
+        for (auto & kv : counters) {
+            ret.refreshes += kv.second.refreshes;
+            ret.full_refreshes += kv.second.full_refreshes;
+            ret.pixels += kv.second.pixels;
+        }
+        return ret;
+    }
+
+    void report(std::ostream & out) const
+    {
+        out << "waveform refreshes full_refreshes pixels" << std::endl;
+        for (auto & kv : counters) {
+            out << kv.first << " " << kv.second.refreshes << " "
+                << kv.second.full_refreshes << " " << kv.second.pixels << std::endl;
+        }
+    }
+
+    // Save the current frame as a png
+    void dump(const std::string & filename)
+    {
+        save_lodepng(filename, 0, 0, width, height);
+    }
+
+private:
+    int marker = 0;
+};
+
+// Make the headless framebuffer the one rmkit uses. This has to happen
+// before anything calls framebuffer::get().
+inline std::shared_ptr<HeadlessFB> install_headless_fb()
+{
+    auto fb = std::make_shared<HeadlessFB>();
+    framebuffer::_FB = fb;
+    return fb;
+}
+
+// Set by SIGINT / SIGTERM, or when a replay finishes; the main loop exits
+// when it's set.
+inline volatile std::sig_atomic_t & stop_requested()
+{
+    static volatile std::sig_atomic_t stop = 0;
+    return stop;
+}
+
+inline void install_stop_signal_handlers()
+{
+    auto handler = [](int) { stop_requested() = 1; };
+    std::signal(SIGINT, handler);
+    std::signal(SIGTERM, handler);
+}
+
+#endif // RMP_HEADLESS_HPP
@@ -5,46 +5,68 @@
 
 #include <iostream>
 #include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
 
 #include <rmkit.h>
 
 #include "game_list.hpp"
 #include "paths.hpp"
 #include "puzzles.hpp"
+#include "ui/canvas.hpp"
+#include "ui/puzzle_drawer.hpp"
+#include "worker.hpp"
 
+// Renders a game's icon to an offscreen canvas. Nothing here touches the
+// display, so icons can be drawn on any thread.
 class GameIcon : public frontend {
 public:
-    Canvas * canvas;
+    std::unique_ptr<Canvas> canvas;
     std::unique_ptr<PuzzleDrawer> drawer;
     int game_w, game_h;
+    // Draw at this tile size (shrinking only if the canvas is too small),
+    // rather than filling the canvas. 0 = fill.
+    int tilesize = 0;
 
 public:
-    GameIcon(int x, int y, int w, int h)
+    GameIcon(int w, int h)
     {
-        canvas = new Canvas(x, y, w, h);
-        drawer = std::make_unique<PuzzleDrawer>(canvas);
+        canvas = std::make_unique<Canvas>(0, 0, w, h);
+        drawer = std::make_unique<PuzzleDrawer>(canvas.get());
     }
 
-    void set_game(const game * a_game)
+    bool set_game(const game * a_game, const std::string & save_dir)
     {
         init_midend(drawer.get(), a_game);
-        load_save_file("/opt/etc/puzzle-icons/" + paths::game_basename(a_game) + ".sav");
+        // Icons are drawn in parallel already
+        config.render_bands = 1;
+        return load_save_file(save_dir + "/" + paths::game_basename(a_game) + ".sav");
     }
 
     void init_game()
     {
-        canvas->drawfb()->clear_screen();
+        drawer->clear();
 
-        // resize and center the canvas
+        // resize the canvas
         game_w = canvas->w;
         game_h = canvas->h;
-        midend_size(me, &game_w, &game_h, /* user_size = */ true);
-        canvas->translate((canvas->w - game_w) / 2, (canvas->h - game_h) / 2);
+        if (tilesize > 0) {
+            me->preferred_tilesize = tilesize;
+            midend_size(me, &game_w, &game_h, /* user_size = */ false);
+        } else {
+            midend_size(me, &game_w, &game_h, /* user_size = */ true);
+        }
+        canvas->resize_layers(game_w, game_h);
         midend_redraw(me);
     }
 
+    // Dithers the canvas (in place) first, as it would be on screen
     std::string save_png(const std::string & filename)
     {
+        dither_rect(canvas->drawfb(), 0, 0, game_w, game_h);
         return canvas->drawfb()->save_lodepng(filename, 0, 0, game_w, game_h);
     }
 
@@ -68,43 +90,71 @@ public:
     void status_bar(const char *text) {}
 };
 
+// Generates every game's icon from its save file, without a display:
+//
+//   puzzle-icons SAVE_DIR OUT_DIR [SIZE...]
+//
+// Each size is written to OUT_DIR/SIZE/<game>.png. Games are rendered in
+// parallel, one per thread.
 class IconApp {
 public:
+    std::string save_dir;
+    std::string out_dir;
+    std::vector<int> sizes;
+
     IconApp(int argc, char *argv[])
     {
-        int size = 0;
-        if (argc > 1)
-            size = atoi(argv[1]);
-        if (size == 0)
-            size = 300;
-
-        auto fb = framebuffer::get();
-        fb->clear_screen();
-        fb->waveform_mode = WAVEFORM_MODE_INIT;
-        fb->redraw_screen(true);
-
-        auto scene = ui::make_scene();
-        int x = 0, y = 0;
-        for (auto * g : GAME_LIST) {
-            auto icon = new GameIcon(x, y, size, size);
-            icon->set_game(g);
-            icon->save_png("/opt/etc/puzzle-icons/" + paths::game_basename(g) + ".png");
-            scene->add(icon->canvas);
-            x += size;
-            if (x+size > fb->width) {
-                x = 0;
-                y += size;
-            }
+        save_dir = argc > 1 ? argv[1] : "vendor/puzzles/icons";
+        out_dir = argc > 2 ? argv[2] : "build/icons";
+        for (int i = 3; i < argc; i++) {
+            int size = atoi(argv[i]);
+            if (size > 0)
+                sizes.push_back(size);
+            else
+                std::cerr << "Invalid icon size: " << argv[i] << std::endl;
         }
+        if (sizes.empty())
+            sizes.push_back(300);
+    }
 
-        ui::MainLoop::set_scene(scene);
-        ui::MainLoop::refresh();
+    int run()
+    {
+        for (int size : sizes)
+            mkdir((out_dir + "/" + std::to_string(size)).c_str(), 0755);
+
+        std::mutex m;
+        int failed = 0;
+        {
+            WorkQueue queue(std::thread::hardware_concurrency());
+            for (auto * g : GAME_LIST) {
+                queue.add([&, g]() {
+                    bool ok = render_game(g);
+                    std::lock_guard<std::mutex> lock(m);
+                    std::cerr << (ok ? "Generated " : "Failed ")
+                              << paths::game_basename(g) << std::endl;
+                    if (!ok)
+                        failed++;
+                });
+            }
+            queue.wait();
+        }
+        return failed == 0 ? 0 : 1;
     }
 
-    void run()
+    bool render_game(const game * g)
     {
-        ui::MainLoop::main();
-        ui::MainLoop::redraw();
+        for (int size : sizes) {
+            GameIcon icon(size, size);
+            if (!icon.set_game(g, save_dir))
+                return false;
+            std::string fname = out_dir + "/" + std::to_string(size) + "/"
+                              + paths::game_basename(g) + ".png";
+            icon.save_png(fname);
+            struct stat st;
+            if (stat(fname.c_str(), &st) != 0)
+                return false;
+        }
+        return true;
     }
 };
 
@@ -0,0 +1,92 @@
+#ifndef RMP_LAYOUT_CACHE_HPP
+#define RMP_LAYOUT_CACHE_HPP
+
+// Borders that GameScene::init_game has already worked out, so switching
+// games or starting a new puzzle doesn't search for one again.
+//
+// The border only depends on the game, its params, the canvas size and the
+// tile size limits in the config, so those make up the key. The cache is a
+// text file with a line per entry:
+//
+//   <border> <key>
+
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+
+#include "paths.hpp"
+#include "puzzles.hpp"
+#include "worker.hpp"
+
+class LayoutCache {
+public:
+    // There are only so many games and presets; anything past this is
+    // probably custom params, so start again rather than grow forever.
+    static const size_t MAX_ENTRIES = 512;
+
+    LayoutCache(const std::string & filename) : filename(filename) {}
+
+    static std::string key(const game * g, const game_params * params,
+                           int w, int h, const Config & config)
+    {
+        char * encoded = g->encode_params(params, false);
+        std::ostringstream out;
+        out << paths::game_basename(g) << " " << encoded
+            << " " << w << "x" << h
+            << " " << config.min_tilesize << "-" << config.max_tilesize;
+        sfree(encoded);
+        return out.str();
+    }
+
+    bool get(const std::string & key, int & border)
+    {
+        if (!loaded)
+            load();
+        auto it = entries.find(key);
+        if (it == entries.end())
+            return false;
+        border = it->second;
+        return true;
+    }
+
+    // Add an entry and save the cache (in the background)
+    void set(const std::string & key, int border)
+    {
+        if (entries.size() >= MAX_ENTRIES)
+            entries.clear();
+        entries[key] = border;
+        std::ostringstream out;
+        for (auto & kv : entries)
+            out << kv.second << " " << kv.first << "\n";
+        std::string data = out.str();
+        std::string fname = filename;
+        background_queue().add([=]() {
+            frontend::write_file(fname, data);
+        });
+    }
+
+protected:
+    std::string filename;
+    bool loaded = false;
+    std::map<std::string, int> entries;
+
+    void load()
+    {
+        loaded = true;
+        std::ifstream in(filename);
+        int border;
+        std::string key;
+        while (in >> border && std::getline(in >> std::ws, key))
+            entries[key] = border;
+    }
+};
+
+// The app's layout cache (only used on the UI thread)
+inline LayoutCache & layout_cache()
+{
+    static LayoutCache cache(paths::layout_cache());
+    return cache;
+}
+
+#endif // RMP_LAYOUT_CACHE_HPP
@@ -1,73 +1,339 @@
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include <rmkit.h>
 
+#include "alloc.hpp"
+#include "game_list.hpp"
+#include "headless.hpp"
+#include "paths.hpp"
 #include "puzzles.hpp"
+#include "session.hpp"
+#include "snapshot.hpp"
 #include "ui/chooser_scene.hpp"
 #include "ui/game_scene.hpp"
 
-const int AUTO_SAVE_INTERVAL = 30000;
+// Delay before preloading a game behind the chooser at startup
+const int PRELOAD_DELAY = 500;
+
+// Set by SIGUSR1; the main loop prints reports (a signal handler can't)
+static volatile std::sig_atomic_t report_requested = 0;
+// Set by SIGTSTP (sent by launchers when switching apps); the main loop
+// saves and snapshots before stopping
+static volatile std::sig_atomic_t suspend_requested = 0;
 
 class App {
 public:
     std::shared_ptr<GameScene> game_scene;
     std::shared_ptr<ChooserScene> chooser_scene;
-    ui::TimerPtr auto_save_timer;
-    game_state * last_save = NULL;
+    std::string record_file;
+
+    // Times the main loop has woken up (for input, a timer, or a task handed
+    // back from another thread). Nothing wakes it periodically, so while the
+    // player is idle this should stay put.
+    long wakeups = 0;
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
 
     App()
     {
+        ui::Style::DEFAULT.font_size = 30;
+        ui::Button::DEFAULT_STYLE += ui::Stylesheet().valign_middle();
+    }
+
+    // Put up the first screen: the last run's snapshot if there is one,
+    // otherwise the chooser, while preloading the last game played.
+    // Non-interactive runs (replays, headless) always start from a bare
+    // chooser.
+    void start(bool interactive)
+    {
+        if (interactive && resume_from_snapshot())
+            return;
+
         auto fb = framebuffer::get();
         fb->clear_screen();
         fb->redraw_screen(true);
 
-        ui::Style::DEFAULT.font_size = 30;
-        ui::Button::DEFAULT_STYLE += ui::Stylesheet().valign_middle();
-
-        chooser_scene = std::make_shared<ChooserScene>();
-        chooser_scene->game_selected += PLS_DELEGATE(on_game_selected);
-        chooser_scene->show();
+        show_chooser();
 
         ui::MainLoop::refresh();
         ui::MainLoop::redraw();
+
+        const game * last = interactive ? last_played() : NULL;
+        if (last != NULL) {
+            // once the chooser is on screen
+            ui::set_timeout([=]() {
+                if (!game_scene && chooser_scene->is_shown()) {
+                    create_game_scene();
+                    game_scene->preload(last);
+                }
+            }, PRELOAD_DELAY);
+        }
+    }
+
+    static const game * last_played()
+    {
+        std::ifstream f(paths::last_game());
+        std::string name;
+        return f >> name ? find_game(name) : NULL;
+    }
+
+    static const game * find_game(const std::string & name)
+    {
+        auto it = std::find_if(std::begin(GAME_LIST), std::end(GAME_LIST),
+                [&](const game * g) { return paths::game_basename(g) == name; });
+        return it == std::end(GAME_LIST) ? NULL : *it;
+    }
+
+    // The chooser loads every game's icon, so it isn't built until it's
+    // first needed
+    void show_chooser()
+    {
+        if (!chooser_scene) {
+            chooser_scene = std::make_shared<ChooserScene>();
+            chooser_scene->game_selected += PLS_DELEGATE(on_game_selected);
+        }
+        chooser_scene->show();
+    }
+
+    // -- Snapshots --
+
+    // Put the last run's screen up straight away (a single refresh), then
+    // load its game underneath. The game scene draws the same pixels, so
+    // showing it doesn't need another full refresh. The snapshot is removed
+    // once read, so a crash while resuming means a normal start next time.
+    bool resume_from_snapshot()
+    {
+        Snapshot snap;
+        bool ok = snap.load(paths::snapshot());
+        std::remove(paths::snapshot().c_str());
+        const game * g = ok ? find_game(snap.game) : NULL;
+        auto fb = framebuffer::get();
+        if (g == NULL || !snap.blit(fb.get()))
+            return false;
+        fb->redraw_screen(true);
+        create_game_scene();
+        game_scene->set_game(g);
+        game_scene->show(false);
+        return true;
+    }
+
+    // Save the open game, and snapshot the screen if a game is showing
+    // (replays leave the player's files alone)
+    void write_snapshot()
+    {
+        if (game_scene && !game_scene->save_enabled) {
+            // replaying
+        } else {
+            // Moves are saved after a delay, so one may still be pending
+            // (even under a dialog or the menu)
+            if (game_scene)
+                game_scene->flush_save();
+            if (game_scene && game_scene->is_shown()
+                    && !ui::MainLoop::overlay_is_visible())
+                Snapshot::save(paths::snapshot(), framebuffer::get().get(),
+                               paths::game_basename(game_scene->ourgame));
+            else
+                std::remove(paths::snapshot().c_str());
+        }
+        // Saves (including the one above) may still be writing
+        background_queue().wait();
+    }
+
+    void create_game_scene()
+    {
+        if (game_scene)
+            return;
+        game_scene = std::make_shared<GameScene>();
+        if (!record_file.empty()) {
+            game_scene->recorder = std::make_unique<SessionRecorder>();
+            game_scene->recorder->open(record_file);
+        }
+        game_scene->back_click += [=](auto & ev) {
+            // stop timers
+            game_scene->deactivate_timer();
+            game_scene->flush_save();
+            // switch scene
+            show_chooser();
+        };
     }
 
     void on_game_selected(const game & g)
     {
-        if (!game_scene) {
-            game_scene = std::make_shared<GameScene>();
-            game_scene->back_click += [=](auto & ev) {
-                // stop timers
-                game_scene->deactivate_timer();
-                ui::cancel_timer(auto_save_timer);
-                auto_save_timer = nullptr;
-                // switch scene
-                chooser_scene->show();
-            };
+        create_game_scene();
+        if (game_scene->save_enabled) { // not while replaying
+            std::string name = paths::game_basename(&g);
+            background_queue().add([=]() {
+                frontend::write_file(paths::last_game(), name);
+            });
         }
         game_scene->set_game(&g);
-        last_save = game_scene->get_game_state();
-        if (auto_save_timer)
-            ui::cancel_timer(auto_save_timer);
-        auto_save_timer = ui::set_interval([=]() {
-            if (game_scene && game_scene->get_game_state() != NULL
-                    && last_save != game_scene->get_game_state()) {
-                game_scene->save_state();
-                std::cerr << "auto save" << std::endl;
-                last_save = game_scene->get_game_state();
-            }
-        }, AUTO_SAVE_INTERVAL);
         game_scene->show();
     }
 
+    // -- Replaying recorded sessions --
+    SessionLog replay_log;
+    float replay_speed = 1;
+    std::chrono::steady_clock::time_point replay_start;
+    struct EventCost {
+        size_t game;
+        int key;
+        float ms;
+    };
+    std::vector<EventCost> replay_costs;
+
+    // Replay a session log, then exit. speed scales time (2 = twice as fast);
+    // 0 replays events back to back.
+    void start_replay(const std::string & filename, float speed)
+    {
+        if (!replay_log.load(filename)) {
+            stop_requested() = 1;
+            return;
+        }
+        replay_speed = speed;
+        replay_game(0);
+    }
+
+    void replay_game(size_t idx)
+    {
+        if (idx >= replay_log.games.size()) {
+            finish_replay();
+            return;
+        }
+        auto & rg = replay_log.games[idx];
+        const game * g = find_game(rg.name);
+        if (g == NULL) {
+            std::cerr << "replay: unknown game " << rg.name << std::endl;
+            replay_game(idx + 1);
+            return;
+        }
+        create_game_scene();
+        game_scene->save_enabled = false;
+        on_game_selected(*g);
+        if (!game_scene->load_state_data(rg.state)) {
+            replay_game(idx + 1);
+            return;
+        }
+        replay_start = std::chrono::steady_clock::now();
+        replay_event(idx, 0);
+    }
+
+    void replay_event(size_t game_idx, size_t ev_idx)
+    {
+        auto & events = replay_log.games[game_idx].events;
+        if (ev_idx >= events.size()) {
+            ui::set_timeout([=]() { replay_game(game_idx + 1); }, 0);
+            return;
+        }
+        // Events are timed from the start of their game, so slow frames
+        // don't push back everything after them.
+        auto ev = events[ev_idx];
+        int delay = 0;
+        if (replay_speed > 0) {
+            auto due = replay_start + std::chrono::milliseconds((long)(ev.ms / replay_speed));
+            delay = std::max(0L, (long)std::chrono::duration_cast<std::chrono::milliseconds>(
+                        due - std::chrono::steady_clock::now()).count());
+        }
+        ui::set_timeout([=]() {
+            auto start = std::chrono::steady_clock::now();
+            game_scene->handle_puzzle_key(ev.x, ev.y, ev.key);
+            ui::MainLoop::redraw();
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            replay_costs.push_back({ game_idx, ev.key,
+                std::chrono::duration<float, std::milli>(elapsed).count() });
+            replay_event(game_idx, ev_idx + 1);
+        }, delay);
+    }
+
+    // Per-event frame cost (key processing + drawing + presenting)
+    void finish_replay()
+    {
+        std::cout << "game event key ms" << std::endl;
+        std::vector<float> ms;
+        for (size_t i = 0; i < replay_costs.size(); i++) {
+            auto & c = replay_costs[i];
+            std::cout << replay_log.games[c.game].name << " " << i << " "
+                      << c.key << " " << c.ms << std::endl;
+            ms.push_back(c.ms);
+        }
+        if (!ms.empty()) {
+            std::sort(ms.begin(), ms.end());
+            float total = 0;
+            for (float m : ms)
+                total += m;
+            std::cout << "events " << ms.size()
+                      << " mean " << total / ms.size()
+                      << " p50 " << ms[ms.size() / 2]
+                      << " p95 " << ms[ms.size() * 95 / 100]
+                      << " max " << ms.back() << std::endl;
+        }
+        stop_requested() = 1;
+    }
+
+    void report(std::ostream & out)
+    {
+        float hours = std::chrono::duration<float>(
+                std::chrono::steady_clock::now() - started).count() / 3600;
+        out << "wakeups: " << wakeups << " in " << hours * 60 << " min ("
+            << (hours > 0 ? wakeups / hours : 0) << " per hour)" << std::endl;
+        alloc_stats_report(out);
+    }
+
+    void poll_report()
+    {
+        if (report_requested) {
+            report_requested = 0;
+            report(std::cerr);
+        }
+    }
+
+    // Runs until SIGINT / SIGTERM, then saves and snapshots for next time
     void run()
     {
-        while (1) {
+        install_stop_signal_handlers();
+        std::signal(SIGUSR1, [](int) { report_requested = 1; });
+        std::signal(SIGTSTP, [](int) { suspend_requested = 1; });
+        while (!stop_requested()) {
+            poll_report();
+            if (suspend_requested) {
+                suspend_requested = 0;
+                write_snapshot();
+                raise(SIGSTOP);
+            }
             // Process events and redraw
             ui::MainLoop::main();
             ui::MainLoop::redraw();
+            // Blocks until there's input, a timer is due, or another thread
+            // has handed back a task
             ui::MainLoop::read_input();
+            wakeups++;
+        }
+        write_snapshot();
+    }
+
+    // There's no input to wait for, so just poll timers and tasks until
+    // signalled (or until run_for_ms has passed, if it's >= 0)
+    void run_headless(int run_for_ms)
+    {
+        install_stop_signal_handlers();
+        auto start = std::chrono::steady_clock::now();
+        std::signal(SIGUSR1, [](int) { report_requested = 1; });
+        while (!stop_requested()) {
+            poll_report();
+            ui::MainLoop::main();
+            ui::MainLoop::redraw();
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            if (run_for_ms >= 0 && elapsed >= std::chrono::milliseconds(run_for_ms))
+                break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
         }
     }
 };
@@ -77,14 +343,68 @@ public:
 int main(int argc, char *argv[])
 {
     IconApp app(argc, argv);
-    app.run();
-    return 0;
+    return app.run();
+}
+#elif defined(RMP_BENCH)
+#include "bench.hpp"
+int main(int argc, char *argv[])
+{
+    BenchApp app(argc, argv);
+    return app.run();
+}
+#elif defined(RMP_RENDER_CHECK)
+#include "render_check.hpp"
+int main(int argc, char *argv[])
+{
+    RenderCheckApp app(argc, argv);
+    return app.run();
 }
 #else
+// Options:
+//   --headless       draw to memory instead of the display
+//   --run-for MS     (headless) exit after MS milliseconds
+//   --dump FILE      (headless) save the last frame to FILE on exit
+//   --record FILE    record every game and key press to a session log
+//   --replay FILE    replay a session log, report frame costs, and exit
+//   --speed F        replay F times as fast (0 = no waiting between events)
 int main(int argc, char * argv[])
 {
+    std::shared_ptr<HeadlessFB> headless;
+    int run_for_ms = -1;
+    std::string dump_file, record_file, replay_file;
+    float speed = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_file = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_file = argv[++i];
+        } else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            speed = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            headless = install_headless_fb();
+        } else if (strcmp(argv[i], "--run-for") == 0 && i + 1 < argc) {
+            run_for_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--dump") == 0 && i + 1 < argc) {
+            dump_file = argv[++i];
+        } else {
+            std::cerr << "unexpected argument: " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+
     App app;
-    app.run();
+    app.record_file = record_file;
+    app.start(!headless && replay_file.empty());
+    if (!replay_file.empty())
+        app.start_replay(replay_file, speed);
+    if (!headless) {
+        app.run();
+        return 0;
+    }
+    app.run_headless(run_for_ms);
+    headless->report(std::cout);
+    if (!dump_file.empty())
+        headless->dump(dump_file);
     return 0;
 }
 #endif
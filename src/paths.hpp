@@ -7,7 +7,7 @@
 
 namespace paths {
 
-#ifdef RESIM
+#if defined(RESIM) || defined(RMP_ICON_APP) || defined(RMP_RENDER_CHECK) || defined(RMP_BENCH)
 const std::string PUZZLE_DATA = ".";
 #else
 const std::string PUZZLE_DATA = "/opt/etc/puzzles";
@@ -35,6 +35,24 @@ inline std::string game_save(const game *g)
     return PUZZLE_DATA + "/save/" + game_basename(g) + ".sav";
 }
 
+// Name of the last game played
+inline std::string last_game()
+{
+    return PUZZLE_DATA + "/save/last_game";
+}
+
+// Canvas layouts worked out by init_game
+inline std::string layout_cache()
+{
+    return PUZZLE_DATA + "/save/layout_cache";
+}
+
+// Screen and open game from when the app last exited
+inline std::string snapshot()
+{
+    return PUZZLE_DATA + "/save/snapshot.bin";
+}
+
 inline std::string icon(const std::string & name)
 {
     return PUZZLE_DATA + "/icons/" + name + ".png";
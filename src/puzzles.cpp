@@ -4,9 +4,11 @@
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <sstream>
 #include <sys/time.h>
 
 #include "puzzles.hpp"
+#include "alloc.hpp"
 #include "config.hpp"
 
 // === Debug ===
@@ -66,8 +68,19 @@ bool frontend::load_from_file(const std::string & filename)
         std::cerr << "Error opening save file for reading: " << filename << std::endl;
         return false;
     }
+    return deserialise(f, filename);
+}
+
+bool frontend::load_from_string(const std::string & data)
+{
+    std::istringstream f(data);
+    return deserialise(f, "<string>");
+}
+
+bool frontend::deserialise(std::istream & f, const std::string & name)
+{
     auto write_fn = [](void * fs, void * buf, int len) {
-        std::ifstream * f = static_cast<std::ifstream *>(fs);
+        std::istream * f = static_cast<std::istream *>(fs);
         f->read(static_cast<char*>(buf), len);
         return f->good();
     };
@@ -75,25 +88,36 @@ bool frontend::load_from_file(const std::string & filename)
     if (err == NULL) {
         return true;
     } else {
-        std::cerr << "Error parsing save file: " << filename << std::endl;
+        std::cerr << "Error parsing save file: " << name << std::endl;
         std::cerr << err << std::endl;
         return false;
     }
 }
 
 bool frontend::save_to_file(const std::string & filename)
+{
+    return write_file(filename, serialise(me));
+}
+
+std::string frontend::serialise(midend * me)
+{
+    std::string ret;
+    auto write_fn = [](void * str, const void * buf, int len) {
+        static_cast<std::string *>(str)->append(static_cast<const char*>(buf), len);
+    };
+    AllocScope scope(me->ourgame, AllocPhase::SERIALISE);
+    midend_serialise(me, write_fn, &ret);
+    return ret;
+}
+
+bool frontend::write_file(const std::string & filename, const std::string & data)
 {
     std::ofstream f(filename);
     if (!f) {
         std::cerr << "Error opening save file for writing: " << filename << std::endl;
         return false;
     }
-    auto write_fn = [](void * fs, const void * buf, int len) {
-        std::ofstream * f = static_cast<std::ofstream *>(fs);
-        if (f)
-            f->write(static_cast<const char*>(buf), len);
-    };
-    midend_serialise(me, write_fn, &f);
+    f.write(data.data(), data.size());
     return f.good();
 }
 
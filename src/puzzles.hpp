@@ -11,6 +11,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <istream>
 #include <string>
 #include <sys/time.h>
 
@@ -57,8 +58,17 @@ public:
 
     virtual void init_midend(DrawingApi * drawer, const game *ourgame);
     bool load_from_file(const std::string & filename);
+    bool load_from_string(const std::string & data);
     bool save_to_file(const std::string & filename);
 
+    // Serialise a midend to a string (e.g. to write it out on another thread)
+    static std::string serialise(midend * me);
+    static bool write_file(const std::string & filename, const std::string & data);
+
+protected:
+    bool deserialise(std::istream & in, const std::string & name);
+
+public:
     // -- Midend functions --
     virtual void frontend_default_colour(float *output)
     {
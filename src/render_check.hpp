@@ -0,0 +1,240 @@
+// Standalone app to check rendering against golden images and timings
+
+#ifndef RMP_RENDER_CHECK_HPP
+#define RMP_RENDER_CHECK_HPP
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <rmkit.h>
+
+#include "game_list.hpp"
+#include "icons.hpp"
+#include "paths.hpp"
+#include "puzzles.hpp"
+
+// Renders each game (from its icon save file, and from a few seeded game
+// IDs) at several tile sizes, and compares the result with golden images
+// made by an earlier --update run:
+//
+//   render-check [--update] [--tilesizes N,N...] [--threshold F] SAVE_DIR GOLDEN_DIR
+//
+// The golden images and timings are tracked in tests/golden/.
+//
+// Images may differ by a few pixels per drawing operation (rasteriser
+// rounding, mostly); anything beyond that is a mismatch. Draw times are
+// compared with GOLDEN_DIR/timings.txt, and anything more than threshold
+// (default 0.25 = 25%) slower is a regression. Exits non-zero if any case
+// fails.
+class RenderCheckApp {
+public:
+    // Pixels that may differ per operation of each DrawOp::Kind
+    static constexpr int PIXEL_TOLERANCE[DrawOp::NUM_KINDS] = {
+        8, // BITMAP (text)
+        0, // RECT
+        2, // LINE
+        4, // POLYGON
+        4, // CIRCLE
+        0, // CLIP
+        0, // UNCLIP
+    };
+    // Gray levels (out of 255) within which pixels count as the same
+    static const int GRAY_TOLERANCE = 8;
+    // Timings are the best of this many redraws
+    static const int TIMING_RUNS = 5;
+    // Differences smaller than this are noise
+    static constexpr float MIN_TIME_SLACK_MS = 1.0;
+
+    static const std::vector<std::string> SEEDS;
+    // Canvas for each case; big enough for the default params at the
+    // largest tile size checked
+    static const int CANVAS_SIZE = 2048;
+
+    bool update = false;
+    float threshold = 0.25;
+    std::vector<int> tilesizes { 32, 96 };
+    std::string save_dir;
+    std::string golden_dir;
+
+    std::map<std::string, float> baseline;
+    std::map<std::string, float> timings;
+    int failures = 0;
+
+    RenderCheckApp(int argc, char *argv[])
+    {
+        std::vector<std::string> args;
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--update") {
+                update = true;
+            } else if (arg == "--threshold" && i + 1 < argc) {
+                threshold = atof(argv[++i]);
+            } else if (arg == "--tilesizes" && i + 1 < argc) {
+                tilesizes.clear();
+                std::stringstream ss(argv[++i]);
+                std::string size;
+                while (std::getline(ss, size, ','))
+                    tilesizes.push_back(atoi(size.c_str()));
+            } else {
+                args.push_back(arg);
+            }
+        }
+        save_dir = args.size() > 0 ? args[0] : "vendor/puzzles/icons";
+        golden_dir = args.size() > 1 ? args[1] : "tests/golden";
+    }
+
+    int run()
+    {
+        mkdir(golden_dir.c_str(), 0755);
+        load_timings();
+        for (auto * g : GAME_LIST) {
+            for (int tilesize : tilesizes) {
+                check(g, "", tilesize);
+                for (auto & seed : SEEDS)
+                    check(g, seed, tilesize);
+            }
+        }
+        if (update)
+            save_timings();
+        if (failures == 0) {
+            std::cerr << "All cases passed" << std::endl;
+            return 0;
+        }
+        std::cerr << failures << " cases failed" << std::endl;
+        return 1;
+    }
+
+protected:
+    // Render one case. An empty seed means the icon save file.
+    void check(const game * g, const std::string & seed, int tilesize)
+    {
+        std::string name = paths::game_basename(g) + "-"
+                         + (seed.empty() ? "save" : seed) + "-t"
+                         + std::to_string(tilesize);
+        GameIcon icon(CANVAS_SIZE, CANVAS_SIZE);
+        icon.tilesize = tilesize;
+        bool ok = seed.empty() ? icon.set_game(g, save_dir) : start_game(icon, g, seed);
+        if (!ok) {
+            fail(name, "could not start game");
+            return;
+        }
+        icon.config.render_bands = 0; // time the normal (banded) path
+
+        // Timing: best of a few full redraws
+        icon.drawer->op_counts = {};
+        float best = 0;
+        for (int i = 0; i < TIMING_RUNS; i++) {
+            icon.drawer->clear();
+            auto start = std::chrono::steady_clock::now();
+            midend_force_redraw(icon.me);
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            float ms = std::chrono::duration<float, std::milli>(elapsed).count();
+            if (i == 0 || ms < best)
+                best = ms;
+        }
+        timings[name] = best;
+
+        std::string fname = golden_dir + "/" + name + ".png";
+        if (update) {
+            icon.save_png(fname);
+            std::cerr << "updated " << name << std::endl;
+            return;
+        }
+
+        // Compare images
+        int allowed = 0;
+        for (int i = 0; i < DrawOp::NUM_KINDS; i++)
+            allowed += PIXEL_TOLERANCE[i] * icon.drawer->op_counts[i] / TIMING_RUNS;
+        int w, h;
+        unsigned char * golden = stbi_load(fname.c_str(), &w, &h, NULL, 4);
+        if (golden == NULL) {
+            fail(name, "missing golden image");
+            return;
+        }
+        int diff = 0;
+        if (w != icon.game_w || h != icon.game_h) {
+            diff = -1;
+        } else {
+            auto fb = icon.canvas->drawfb();
+            dither_rect(fb, 0, 0, w, h); // as save_png does
+            for (int y = 0; y < h; y++) {
+                for (int x = 0; x < w; x++) {
+                    // compare the top bits of red; puzzles only draw grays
+                    int actual = (fb->fbmem[y*fb->width + x] >> 11) << 3;
+                    int expected = golden[4*(y*w + x)];
+                    if (std::abs(actual - expected) > GRAY_TOLERANCE)
+                        diff++;
+                }
+            }
+        }
+        stbi_image_free(golden);
+        if (diff < 0) {
+            fail(name, "size changed");
+        } else if (diff > allowed) {
+            fail(name, std::to_string(diff) + " pixels differ (allowed "
+                       + std::to_string(allowed) + ")");
+        }
+
+        // Compare timing
+        auto it = baseline.find(name);
+        if (it != baseline.end()
+                && best > it->second * (1 + threshold) + MIN_TIME_SLACK_MS) {
+            char msg[100];
+            snprintf(msg, sizeof(msg), "draw took %.2f ms (baseline %.2f ms)",
+                     best, it->second);
+            fail(name, msg);
+        }
+    }
+
+    bool start_game(GameIcon & icon, const game * g, const std::string & seed)
+    {
+        icon.init_midend(icon.drawer.get(), g);
+        // params#seed, as an empty params string doesn't decode to the
+        // defaults in every game
+        game_params * params = g->default_params();
+        char * encoded = g->encode_params(params, true);
+        std::string id = std::string(encoded) + "#" + seed;
+        sfree(encoded);
+        g->free_params(params);
+        const char * err = midend_game_id(icon.me, id.c_str());
+        if (err != NULL) {
+            std::cerr << "Error setting game id: " << err << std::endl;
+            return false;
+        }
+        midend_new_game(icon.me);
+        icon.init_game();
+        return true;
+    }
+
+    void fail(const std::string & name, const std::string & msg)
+    {
+        std::cerr << "FAIL " << name << ": " << msg << std::endl;
+        failures++;
+    }
+
+    void load_timings()
+    {
+        std::ifstream f(golden_dir + "/timings.txt");
+        std::string name;
+        float ms;
+        while (f >> name >> ms)
+            baseline[name] = ms;
+    }
+
+    void save_timings()
+    {
+        std::ofstream f(golden_dir + "/timings.txt");
+        for (auto & kv : timings)
+            f << kv.first << " " << kv.second << std::endl;
+    }
+};
+
+const std::vector<std::string> RenderCheckApp::SEEDS { "golden1", "golden2" };
+
+#endif // RMP_RENDER_CHECK_HPP
@@ -0,0 +1,128 @@
+#ifndef RMP_SESSION_HPP
+#define RMP_SESSION_HPP
+
+// Recording of real play sessions, so they can be replayed (and profiled)
+// later, on the device or headless.
+//
+// A session log is a text file with a block per game:
+//
+//   game <basename>
+//   id <game id, including params>
+//   seed <random seed, including params> (or "-")
+//   state <length>
+//   <serialised game, exactly length bytes>
+//   k <ms> <x> <y> <key>
+//   k ...
+//
+// A new block starts whenever the game is replaced other than by a key
+// press (new game, restart, solve, switching games). Key times are in ms
+// since the start of their block.
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "paths.hpp"
+#include "puzzles.hpp"
+
+class SessionRecorder {
+public:
+    bool open(const std::string & filename)
+    {
+        out.open(filename);
+        if (!out) {
+            std::cerr << "Error opening session log for writing: " << filename << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    void start_game(frontend * fe)
+    {
+        if (!out || fe->me == NULL)
+            return;
+        char * id = midend_get_game_id(fe->me);
+        char * seed = midend_get_random_seed(fe->me);
+        std::string state = frontend::serialise(fe->me);
+        out << "game " << paths::game_basename(fe->ourgame) << "\n"
+            << "id " << id << "\n"
+            << "seed " << (seed != NULL ? seed : "-") << "\n"
+            << "state " << state.size() << "\n" << state << "\n";
+        out.flush();
+        sfree(id);
+        sfree(seed);
+        start = std::chrono::steady_clock::now();
+    }
+
+    void key(int x, int y, int key_id)
+    {
+        if (!out)
+            return;
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        out << "k " << ms << " " << x << " " << y << " " << key_id << "\n";
+    }
+
+protected:
+    std::ofstream out;
+    std::chrono::steady_clock::time_point start;
+};
+
+struct SessionLog {
+    struct Event {
+        long ms;
+        int x, y, key;
+    };
+    struct Game {
+        std::string name;
+        std::string id;
+        std::string seed;
+        std::string state;
+        std::vector<Event> events;
+    };
+    std::vector<Game> games;
+
+    bool load(const std::string & filename)
+    {
+        std::ifstream in(filename);
+        if (!in) {
+            std::cerr << "Error opening session log for reading: " << filename << std::endl;
+            return false;
+        }
+        std::string tag;
+        while (in >> tag) {
+            if (tag == "game") {
+                games.emplace_back();
+                in >> games.back().name;
+            } else if (games.empty()) {
+                break;
+            } else if (tag == "id") {
+                std::getline(in >> std::ws, games.back().id);
+            } else if (tag == "seed") {
+                std::getline(in >> std::ws, games.back().seed);
+            } else if (tag == "state") {
+                size_t len;
+                in >> len;
+                in.ignore(1); // newline
+                games.back().state.resize(len);
+                in.read(&games.back().state[0], len);
+            } else if (tag == "k") {
+                Event ev;
+                in >> ev.ms >> ev.x >> ev.y >> ev.key;
+                games.back().events.push_back(ev);
+            } else {
+                break;
+            }
+        }
+        if (!in.eof()) {
+            std::cerr << "Error reading session log: " << filename
+                      << " (unexpected \"" << tag << "\")" << std::endl;
+            return false;
+        }
+        return true;
+    }
+};
+
+#endif // RMP_SESSION_HPP
@@ -0,0 +1,139 @@
+#ifndef RMP_SNAPSHOT_HPP
+#define RMP_SNAPSHOT_HPP
+
+// The screen and the open game, saved on exit so the next launch can show
+// them straight away instead of starting from the chooser.
+//
+// File format (native byte order; it's only read back on the same device):
+//
+//   "RMPS" <u32 version> <u32 width> <u32 height> <u32 bytes per pixel>
+//   <u32 name length> <game basename>
+//   runs of <u16 count> <pixel>, row-major, until width * height pixels
+//
+// Puzzle screens are mostly long runs of white, so run-length encoding
+// keeps a full-screen snapshot to a few hundred KB.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <rmkit.h>
+
+class Snapshot {
+public:
+    static const uint32_t VERSION = 1;
+    static const uint32_t MAX_NAME = 64;
+    static const int MAX_SIZE = 4096;
+
+    std::string game; // basename
+    int width = 0, height = 0;
+    std::vector<remarkable_color> pixels;
+
+    // Write to a temp file and rename, so a crash never leaves half a
+    // snapshot behind
+    static bool save(const std::string & filename, framebuffer::FB * fb,
+                     const std::string & game)
+    {
+        std::string tmp = filename + ".tmp";
+        std::ofstream f(tmp, std::ios::binary);
+        if (!f) {
+            std::cerr << "Error opening snapshot for writing: " << tmp << std::endl;
+            return false;
+        }
+        f.write("RMPS", 4);
+        write_u32(f, VERSION);
+        write_u32(f, fb->width);
+        write_u32(f, fb->height);
+        write_u32(f, sizeof(remarkable_color));
+        write_u32(f, game.size());
+        f.write(game.data(), game.size());
+
+        const remarkable_color * px = fb->fbmem;
+        size_t n = (size_t)fb->width * fb->height;
+        for (size_t i = 0; i < n; ) {
+            uint16_t count = 1;
+            while (i + count < n && count < UINT16_MAX && px[i + count] == px[i])
+                count++;
+            f.write(reinterpret_cast<const char *>(&count), sizeof(count));
+            f.write(reinterpret_cast<const char *>(&px[i]), sizeof(remarkable_color));
+            i += count;
+        }
+        f.close();
+        if (!f || std::rename(tmp.c_str(), filename.c_str()) != 0) {
+            std::cerr << "Error writing snapshot: " << filename << std::endl;
+            std::remove(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool load(const std::string & filename)
+    {
+        std::ifstream f(filename, std::ios::binary);
+        if (!f)
+            return false;
+        char magic[4];
+        f.read(magic, 4);
+        if (!f || std::string(magic, 4) != "RMPS" || read_u32(f) != VERSION)
+            return false;
+        width = read_u32(f);
+        height = read_u32(f);
+        if (width <= 0 || height <= 0 || width > MAX_SIZE || height > MAX_SIZE
+                || read_u32(f) != sizeof(remarkable_color))
+            return false;
+        uint32_t len = read_u32(f);
+        if (!f || len > MAX_NAME)
+            return false;
+        game.resize(len);
+        f.read(&game[0], len);
+
+        size_t n = (size_t)width * height;
+        pixels.clear();
+        pixels.reserve(n);
+        while (f && pixels.size() < n) {
+            uint16_t count;
+            remarkable_color value;
+            f.read(reinterpret_cast<char *>(&count), sizeof(count));
+            f.read(reinterpret_cast<char *>(&value), sizeof(value));
+            if (f)
+                pixels.insert(pixels.end(), std::min((size_t)count, n - pixels.size()), value);
+        }
+        if (pixels.size() != n) {
+            std::cerr << "Error reading snapshot: " << filename << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Copy to the framebuffer (which must be the same size) and mark it all
+    // dirty
+    bool blit(framebuffer::FB * fb)
+    {
+        if (fb->width != width || fb->height != height)
+            return false;
+        std::copy(pixels.begin(), pixels.end(), fb->fbmem);
+        fb->update_dirty(fb->dirty_area, 0, 0);
+        fb->update_dirty(fb->dirty_area, width, height);
+        fb->dirty = 1;
+        return true;
+    }
+
+protected:
+    static void write_u32(std::ostream & f, uint32_t value)
+    {
+        f.write(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    static uint32_t read_u32(std::istream & f)
+    {
+        uint32_t value = 0;
+        f.read(reinterpret_cast<char *>(&value), sizeof(value));
+        return value;
+    }
+};
+
+#endif // RMP_SNAPSHOT_HPP
@@ -0,0 +1,119 @@
+#ifndef RMP_SOLVER_HPP
+#define RMP_SOLVER_HPP
+
+// Runs a game's solver on a background thread, so solving a big board
+// doesn't block the UI.
+//
+// The solver works on copies of the midend's states, which are made and
+// freed on the UI thread. Its result is a move string, which is applied on
+// the UI thread as a normal Solve move.
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "alloc.hpp"
+#include "puzzles.hpp"
+#include "worker.hpp"
+
+struct SolveJob {
+    // What was solved (only compared on the UI thread; never dereferenced
+    // by the worker)
+    midend * me = NULL;
+    game_state * state = NULL;
+
+    // Set on the UI thread to drop the result. The solver itself can't be
+    // interrupted, so it still runs to completion.
+    std::atomic<bool> cancelled { false };
+
+    // Results; only valid once done is set (on the UI thread)
+    bool done = false;
+    bool ok = false;
+    std::string move;
+    std::string error;
+};
+
+// Solves run one at a time, in order
+inline WorkQueue & solver_queue()
+{
+    static WorkQueue queue(1);
+    return queue;
+}
+
+// Start solving me's current state. done is called on the UI thread with
+// the finished job, unless it has been cancelled by then.
+inline std::shared_ptr<SolveJob> start_solve(midend * me,
+        std::function<void(std::shared_ptr<SolveJob>)> done)
+{
+    auto job = std::make_shared<SolveJob>();
+    job->me = me;
+    job->state = me->states[me->statepos-1].state;
+
+    const game * g = me->ourgame;
+    game_state * orig = g->dup_game(me->states[0].state);
+    game_state * curr = g->dup_game(job->state);
+    bool has_aux = me->aux_info != NULL;
+    std::string aux = has_aux ? me->aux_info : "";
+
+    solver_queue().add([=]() {
+        std::string move, error;
+        bool ok = false;
+        if (!job->cancelled) {
+            AllocScope scope(g, AllocPhase::SOLVE);
+            const char * err = NULL;
+            char * movestr = g->solve(orig, curr, has_aux ? aux.c_str() : NULL, &err);
+            if (movestr != NULL) {
+                move = movestr;
+                sfree(movestr);
+                ok = true;
+            } else {
+                error = err != NULL ? err : "Solve operation failed";
+            }
+        }
+        // States from dup_game can share refcounted data with the midend's
+        // (without atomics), so only the UI thread may free them
+        run_on_ui_thread([=]() {
+            g->free_game(orig);
+            g->free_game(curr);
+            job->done = true;
+            job->ok = ok;
+            job->move = move;
+            job->error = error;
+            if (!job->cancelled)
+                done(job);
+        });
+    });
+    return job;
+}
+
+// The midend has no way to apply a precomputed solution, so midend_solve is
+// given a copy of the game whose solve function just returns it.
+inline std::string & pending_solution()
+{
+    static std::string move;
+    return move;
+}
+
+inline char * precomputed_solve(const game_state *orig, const game_state *curr,
+                                const char *aux, const char **error)
+{
+    return dupstr(pending_solution().c_str());
+}
+
+// Apply a solve job's move to me (as if by midend_solve). Returns an error
+// message, or NULL.
+inline const char * apply_solution(midend * me, const std::string & move)
+{
+    const game * real_game = me->ourgame;
+    game solved_game = *real_game;
+    solved_game.solve = precomputed_solve;
+    pending_solution() = move;
+    me->ourgame = &solved_game;
+    const char * err = midend_solve(me);
+    me->ourgame = real_game;
+    pending_solution().clear();
+    return err;
+}
+
+#endif // RMP_SOLVER_HPP
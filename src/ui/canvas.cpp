@@ -1,3 +1,7 @@
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
 #include "debug.hpp"
 #include "ui/canvas.hpp"
 
@@ -18,10 +22,12 @@ void copy_fb(framebuffer::FB *src, int src_x, int src_y,
     dest->dirty = 1;
 }
 
-Layer::Layer(int w, int h)
+Layer::Layer(int w, int h, bool transparent)
+    : transparent(transparent)
 {
     fb = new framebuffer::VirtualFB(w, h);
     drawfb = fb; // start unclipped
+    clear();
 }
 
 Layer::~Layer()
@@ -51,8 +57,45 @@ void Layer::clip(int x, int y, int w, int h)
             clip_w, clip_h);
 }
 
+void Layer::clear(int x, int y, int w, int h)
+{
+    int x1 = std::min(fb->width, x + w);
+    int y1 = std::min(fb->height, y + h);
+    x = std::max(0, x);
+    y = std::max(0, y);
+    if (x >= x1 || y >= y1)
+        return;
+    remarkable_color bg = transparent ? TRANSPARENT_KEY : WHITE;
+    for (int i = y; i < y1; i++)
+        std::fill(&fb->fbmem[i*fb->width + x], &fb->fbmem[i*fb->width + x1], bg);
+    fb->update_dirty(fb->dirty_area, x, y);
+    fb->update_dirty(fb->dirty_area, x1, y1);
+    fb->dirty = 1;
+    // Nothing left?
+    if (x <= content.x0 && y <= content.y0 && x1 >= content.x1 && y1 >= content.y1) {
+        content.x0 = content.y0 = INT_MAX;
+        content.x1 = content.y1 = INT_MIN;
+    }
+}
+
+void Layer::resize(int w, int h)
+{
+    if (w != fb->width || h != fb->height) {
+        delete fb;
+        fb = new framebuffer::VirtualFB(w, h);
+        drawfb = fb;
+        if (clipfb != NULL) {
+            delete clipfb;
+            clipfb = NULL;
+        }
+    }
+    clear();
+}
+
 void Layer::unclip()
 {
+    if (!is_clipped())
+        return;
     copy_fb(clipfb, clip_x, clip_y,
             fb, clip_x, clip_y,
             clip_w, clip_h);
@@ -63,8 +106,10 @@ void Layer::unclip()
 Canvas::Canvas(int x, int y, int w, int h)
     : ui::Widget(x, y, w, h)
 {
-    add_layer(); // background
-    drawfb(0)->clear_screen();
+    add_layer(false); // background
+    ghost_cols = (w + GHOST_TILE_SIZE - 1) / GHOST_TILE_SIZE;
+    ghost_rows = (h + GHOST_TILE_SIZE - 1) / GHOST_TILE_SIZE;
+    ghosting.resize(ghost_cols * ghost_rows, 0.f);
 }
 
 Canvas::~Canvas()
@@ -73,48 +118,299 @@ Canvas::~Canvas()
         delete layer;
 }
 
-int shrink_x(framebuffer::FB * fb, const framebuffer::FBRect & rect, int start, int end)
+// Index of the first non-white pixel in [start, end), or end if there is none.
+// Checks four pixels at a time.
+static int first_content(const remarkable_color * row, int start, int end)
 {
-    int step = start <= end ? 1 : -1;
-    for (int x = start; x != end; x += step)
-        for (int y = rect.y0; y <= rect.y1; y++)
-            if (fb->fbmem[y*fb->width + x] < 0xffff)
-                return x;
+    const uint64_t white4 = ~(uint64_t)0;
+    int x = start;
+    for (; x + 4 <= end; x += 4) {
+        uint64_t px;
+        memcpy(&px, row + x, sizeof(px));
+        if (px != white4)
+            break;
+    }
+    for (; x < end; x++)
+        if (row[x] != WHITE)
+            return x;
     return end;
 }
 
-int shrink_y(framebuffer::FB * fb, const framebuffer::FBRect & rect, int start, int end)
+// Index of the last non-white pixel in [start, end), or start-1 if there is none.
+static int last_content(const remarkable_color * row, int start, int end)
 {
-    int step = start <= end ? 1 : -1;
-    for (int y = start; y != end; y += step)
-        for (int x = rect.x0; x < rect.x1; x++)
-            if (fb->fbmem[y*fb->width + x] < 0xffff)
-                return y;
-    return end;
+    const uint64_t white4 = ~(uint64_t)0;
+    int x = end;
+    for (; x - 4 >= start; x -= 4) {
+        uint64_t px;
+        memcpy(&px, row + x - 4, sizeof(px));
+        if (px != white4)
+            break;
+    }
+    for (x--; x >= start; x--)
+        if (row[x] != WHITE)
+            return x;
+    return start - 1;
+}
+
+bool scan_content(framebuffer::FB * fb, framebuffer::FBRect & rect)
+{
+    // Row-major, so we read memory in order
+    int x0 = INT_MAX, x1 = INT_MIN, y0 = INT_MAX, y1 = INT_MIN;
+    for (int y = rect.y0; y < rect.y1; y++) {
+        const remarkable_color * row = &fb->fbmem[y*fb->width];
+        int first = first_content(row, rect.x0, rect.x1);
+        if (first == rect.x1)
+            continue;
+        // no need to re-scan the part of the row we've already covered
+        int last = last_content(row, std::max(first, x1), rect.x1);
+        x0 = std::min(x0, first);
+        x1 = std::max(x1, last + 1);
+        y0 = std::min(y0, y);
+        y1 = y + 1;
+    }
+    if (y0 == INT_MAX)
+        return false;
+    rect.x0 = x0; rect.x1 = x1;
+    rect.y0 = y0; rect.y1 = y1;
+    return true;
 }
 
-void shrink_update_rect(framebuffer::FBRect &rect, framebuffer::FB * fb)
+// Thresholds for each gray level (0-31), by row and column
+static const uint16_t BAYER_2[2][2] = { { 4, 20 }, { 28, 12 } };
+
+typedef uint16_t u16x8 __attribute__((vector_size(16)));
+
+void dither_row(const remarkable_color * src, remarkable_color * dest, int n, int x, int y)
 {
-    rect.x0 = shrink_x(fb, rect, rect.x0, rect.x1);
-    rect.x1 = shrink_x(fb, rect, rect.x1, rect.x0);
-    rect.y0 = shrink_y(fb, rect, rect.y0, rect.y1);
-    rect.y1 = shrink_y(fb, rect, rect.y1, rect.y0);
+    uint16_t t0 = BAYER_2[y & 1][x & 1];
+    uint16_t t1 = BAYER_2[y & 1][(x + 1) & 1];
+    // The pattern repeats every two pixels, so one vector of thresholds
+    // covers the row. Gray level is the top 5 bits (red).
+    const u16x8 thresh = { t0, t1, t0, t1, t0, t1, t0, t1 };
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        u16x8 px;
+        memcpy(&px, src + i, sizeof(px));
+        u16x8 out = (u16x8)((px >> 11) > thresh);
+        memcpy(dest + i, &out, sizeof(out));
+    }
+    for (; i < n; i++)
+        dest[i] = (src[i] >> 11) > (i & 1 ? t1 : t0) ? WHITE : BLACK;
 }
 
+void dither_rect(framebuffer::FB * fb, int x, int y, int w, int h)
+{
+    for (int i = y; i < y + h; i++) {
+        remarkable_color * row = &fb->fbmem[i*fb->width + x];
+        dither_row(row, row, w, x, i);
+    }
+}
+
+// Gray level (0-31) of an rgb565 gray
+inline int gray_level(remarkable_color c)
+{
+    return c >> 11;
+}
+
+// Composite part of the layers to the screen, and track how much each
+// ghosting tile changed.
+void Canvas::copy_to_screen(const framebuffer::FBRect & rect)
+{
+    int dest_x = this->x + rect.x0 + trans_x;
+    int dest_y = this->y + rect.y0 + trans_y;
+    int w = rect.x1 - rect.x0;
+    int h = rect.y1 - rect.y0;
+    if (w <= 0 || h <= 0)
+        return;
+
+    // Transparent layers only need compositing where they have content
+    std::vector<Layer*> overlays;
+    for (size_t i = 1; i < layers.size(); i++)
+        if (layers[i]->has_content())
+            overlays.push_back(layers[i]);
+    std::vector<remarkable_color> scratch(overlays.empty() ? 0 : w);
+    std::vector<remarkable_color> dithered(dither ? w : 0);
+
+    bool track_ghosting = ghosting_budget > 0;
+    std::vector<int> row_change(ghost_cols);
+    int tile_area = GHOST_TILE_SIZE * GHOST_TILE_SIZE;
+    framebuffer::FB * base = layers[0]->fb;
+    for (int i = 0; i < h; i++) {
+        int src_y = rect.y0 + i;
+        int y = dest_y + i;
+        const remarkable_color * src_row = &base->fbmem[src_y*base->width + rect.x0];
+        for (auto l : overlays) {
+            const framebuffer::FBRect & c = l->content;
+            int x0 = std::max(c.x0, rect.x0);
+            int x1 = std::min(c.x1, rect.x1);
+            if (src_y < c.y0 || src_y >= c.y1 || x0 >= x1)
+                continue;
+            if (src_row != scratch.data()) {
+                std::copy(src_row, src_row + w, scratch.begin());
+                src_row = scratch.data();
+            }
+            const remarkable_color * over = &l->fb->fbmem[src_y*l->fb->width];
+            for (int x = x0; x < x1; x++)
+                if (over[x] != TRANSPARENT_KEY)
+                    scratch[x - rect.x0] = over[x];
+        }
+        if (dither) {
+            dither_row(src_row, dithered.data(), w, rect.x0, src_y);
+            src_row = dithered.data();
+        }
+
+        auto dest_row = &fb->fbmem[y*fb->width + dest_x];
+        // Most rows haven't changed at all
+        if (memcmp(src_row, dest_row, w * sizeof(remarkable_color)) != 0) {
+            if (track_ghosting) {
+                for (int j = 0; j < w; j++) {
+                    if (src_row[j] != dest_row[j]) {
+                        int col = (dest_x + j - this->x) / GHOST_TILE_SIZE;
+                        if (col >= 0 && col < ghost_cols)
+                            row_change[col] += std::abs(gray_level(src_row[j]) - gray_level(dest_row[j]));
+                    }
+                }
+            }
+            memcpy(dest_row, src_row, w * sizeof(remarkable_color));
+        }
+        // Flush the totals at the end of each tile row
+        if (!track_ghosting)
+            continue;
+        int tile_y = (y - this->y) / GHOST_TILE_SIZE;
+        bool last_row = i == h - 1 || (y + 1 - this->y) % GHOST_TILE_SIZE == 0;
+        if (last_row && tile_y >= 0 && tile_y < ghost_rows) {
+            for (int col = 0; col < ghost_cols; col++) {
+                if (row_change[col] > 0)
+                    ghosting[tile_y*ghost_cols + col] += row_change[col] / (31.f * tile_area);
+                row_change[col] = 0;
+            }
+        }
+    }
+    fb->update_dirty(fb->dirty_area, dest_x, dest_y);
+    fb->update_dirty(fb->dirty_area, dest_x + w, dest_y + h);
+    fb->dirty = 1;
+    schedule_deghost();
+}
+
+// Clear the parts of the canvas outside the layers
+void Canvas::clear_margins()
+{
+    int x0 = this->x + std::max(0, trans_x);
+    int y0 = this->y + std::max(0, trans_y);
+    int x1 = std::min(this->x + this->w, x0 + layers[0]->fb->width);
+    int y1 = std::min(this->y + this->h, y0 + layers[0]->fb->height);
+    int right = this->x + this->w;
+    int bottom = this->y + this->h;
+    if (y0 > this->y)
+        fb->draw_rect(this->x, this->y, this->w, y0 - this->y, WHITE);
+    if (bottom > y1)
+        fb->draw_rect(this->x, y1, this->w, bottom - y1, WHITE);
+    if (x0 > this->x)
+        fb->draw_rect(this->x, y0, x0 - this->x, y1 - y0, WHITE);
+    if (right > x1)
+        fb->draw_rect(x1, y0, right - x1, y1 - y0, WHITE);
+}
+
+void Canvas::schedule_deghost()
+{
+    if (ghosting_budget <= 0)
+        return;
+    if (deghost_timer)
+        ui::cancel_timer(deghost_timer);
+    deghost_timer = ui::set_timeout([=]() {
+        deghost_timer = nullptr;
+        deghost();
+    }, GHOST_IDLE_DELAY);
+}
+
+void Canvas::deghost()
+{
+    // Wait for anything else to be drawn before using the screen
+    if (fb->dirty || ui::MainLoop::overlay_is_visible() || !ui::MainLoop::is_visible(this)) {
+        if (fb->dirty)
+            schedule_deghost();
+        return;
+    }
+
+    // Refresh each horizontal run of tiles that are over budget
+    std::vector<framebuffer::FBRect> rects;
+    for (int row = 0; row < ghost_rows; row++) {
+        for (int col = 0; col < ghost_cols; col++) {
+            if (ghosting[row*ghost_cols + col] <= ghosting_budget)
+                continue;
+            framebuffer::FBRect r;
+            r.x0 = this->x + col * GHOST_TILE_SIZE;
+            r.y0 = this->y + row * GHOST_TILE_SIZE;
+            while (col < ghost_cols && ghosting[row*ghost_cols + col] > ghosting_budget) {
+                ghosting[row*ghost_cols + col] = 0;
+                col++;
+            }
+            r.x1 = std::min(this->x + this->w, this->x + col * GHOST_TILE_SIZE);
+            r.y1 = std::min(this->y + this->h, r.y0 + GHOST_TILE_SIZE);
+            rects.push_back(r);
+        }
+    }
+    if (rects.empty())
+        return;
+    // Lots of small refreshes are worse than one big one
+    if (rects.size() > 8) {
+        framebuffer::FBRect r = rects[0];
+        for (auto & r2 : rects) {
+            r.x0 = std::min(r.x0, r2.x0); r.y0 = std::min(r.y0, r2.y0);
+            r.x1 = std::max(r.x1, r2.x1); r.y1 = std::max(r.y1, r2.y1);
+        }
+        rects = { r };
+    }
+
+    debugf("deghost: %d rects\n", (int)rects.size());
+    auto old_waveform = fb->waveform_mode;
+    auto old_update = fb->update_mode;
+    for (auto & r : rects) {
+        fb->dirty_area = r;
+        fb->dirty = 1;
+        fb->waveform_mode = WAVEFORM_MODE_GC16;
+        fb->update_mode = UPDATE_MODE_PARTIAL;
+        fb->redraw_screen();
+    }
+    fb->waveform_mode = old_waveform;
+    fb->update_mode = old_update;
+}
 
 void Canvas::render()
 {
     if (full_refresh && !ui::MainLoop::overlay_is_visible()) {
         full_refresh = false;
+        reset_ghosting();
         // Clear ghosting by running a FULL update at the next tick.
         ui::set_timeout([=]() {
             // find the minimal area that contains the full game
             // assume any translation is solely done to center the canvas
-            fb->dirty_area.x0 = this->x + trans_x;
-            fb->dirty_area.x1 = this->x + this->w - trans_x;
-            fb->dirty_area.y0 = this->y + trans_y;
-            fb->dirty_area.y1 = this->y + this->h - trans_y;
-            shrink_update_rect(fb->dirty_area, fb);
+            framebuffer::FBRect area;
+            area.x0 = this->x + trans_x;
+            area.x1 = this->x + this->w - trans_x;
+            area.y0 = this->y + trans_y;
+            area.y1 = this->y + this->h - trans_y;
+            Layer * base = layer(0);
+            if (base->has_content()) {
+                // the drawer keeps track of this as it goes
+                framebuffer::FBRect r = base->content;
+                r.x0 = std::max(area.x0, r.x0 + this->x + trans_x);
+                r.x1 = std::min(area.x1, r.x1 + this->x + trans_x);
+                r.y0 = std::max(area.y0, r.y0 + this->y + trans_y);
+                r.y1 = std::min(area.y1, r.y1 + this->y + trans_y);
+#ifndef NDEBUG
+                framebuffer::FBRect check = area;
+                if (scan_content(fb, check) && (check.x0 < r.x0 || check.y0 < r.y0
+                            || check.x1 > r.x1 || check.y1 > r.y1))
+                    debugf("content bounds (%d, %d) -> (%d, %d) missed (%d, %d) -> (%d, %d)\n",
+                           r.x0, r.y0, r.x1, r.y1, check.x0, check.y0, check.x1, check.y1);
+#endif
+                area = r;
+            } else {
+                scan_content(fb, area);
+            }
+            fb->dirty_area = area;
             // run the update
             fb->dirty = 1;
             fb->waveform_mode = WAVEFORM_MODE_GC16;
@@ -123,20 +419,39 @@ void Canvas::render()
         }, 10);
     }
 
-    // TODO: merge layers
-    framebuffer::FB * vfb = drawfb(0);
-
-    auto dirty = vfb->dirty_area;
-    // TODO: this is necessary for painting after an overlay has been shown. Is
-    // there a way to figure out which area is dirty in that situation?
-    dirty.x0 = 0;
-    dirty.y0 = 0;
-    dirty.x1 = vfb->width - trans_x;
-    dirty.y1 = vfb->height - trans_y;
+    // Only composite what's been drawn since the last render. If nothing has
+    // been drawn, we're being re-rendered because something else drew over
+    // the canvas (e.g. an overlay), so composite everything.
+    framebuffer::FBRect damage;
+    damage.x0 = damage.y0 = INT_MAX;
+    damage.x1 = damage.y1 = INT_MIN;
+    for (auto l : layers) {
+        const framebuffer::FBRect & d = l->fb->dirty_area;
+        if (d.x0 > d.x1 || d.y0 > d.y1)
+            continue;
+        damage.x0 = std::min(damage.x0, d.x0);
+        damage.y0 = std::min(damage.y0, d.y0);
+        damage.x1 = std::max(damage.x1, d.x1 + 1);
+        damage.y1 = std::max(damage.y1, d.y1 + 1);
+    }
+    int max_x = std::min(layers[0]->fb->width, this->w - trans_x);
+    int max_y = std::min(layers[0]->fb->height, this->h - trans_y);
+    if (full_damage || damage.x0 == INT_MAX) {
+        clear_margins();
+        damage.x0 = 0;
+        damage.y0 = 0;
+        damage.x1 = max_x;
+        damage.y1 = max_y;
+    } else {
+        damage.x0 = std::max(0, damage.x0);
+        damage.y0 = std::max(0, damage.y0);
+        damage.x1 = std::min(max_x, damage.x1);
+        damage.y1 = std::min(max_y, damage.y1);
+    }
+    full_damage = false;
     debugf("======================RENDER (%d, %d) -> (%d, %d)\n",
-            dirty.x0, dirty.y0, dirty.x1, dirty.y1);
-    copy_fb(vfb, dirty.x0, dirty.y0,
-            fb, this->x + dirty.x0 + trans_x, this->y + dirty.y0 + trans_y,
-            dirty.x1 - dirty.x0, dirty.y1 - dirty.y0);
-    framebuffer::reset_dirty(vfb->dirty_area);
+            damage.x0, damage.y0, damage.x1, damage.y1);
+    copy_to_screen(damage);
+    for (auto l : layers)
+        framebuffer::reset_dirty(l->fb->dirty_area);
 }
@@ -1,10 +1,19 @@
 #ifndef RMP_UI_CANVAS_HPP
 #define RMP_UI_CANVAS_HPP
 
+#include <algorithm>
+#include <climits>
+#include <vector>
+
 #include <rmkit.h>
 
+// Pixels this color in a transparent layer show the layers below. It isn't a
+// gray, so puzzles never draw it.
+const remarkable_color TRANSPARENT_KEY = 0xF81F;
+
 class Layer {
 public:
+    bool transparent;
     framebuffer::VirtualFB * fb;
     framebuffer::VirtualFB * drawfb;
     framebuffer::VirtualFB * clipfb = NULL;
@@ -13,23 +22,79 @@ public:
     int clip_w = 0;
     int clip_h = 0;
 
-    Layer(int w, int h);
+    // Bounding box of everything drawn since the layer was last cleared. This
+    // is maintained by whoever draws to the layer, and may be larger than the
+    // area that's actually non-white.
+    framebuffer::FBRect content;
+
+    Layer(int w, int h, bool transparent = false);
     ~Layer();
     void clip(int x, int y, int w, int h);
     void unclip();
+    // Reallocate the layer if its size has changed, and clear it
+    void resize(int w, int h);
     bool is_clipped() { return drawfb == clipfb; };
+
+    void clear()
+    {
+        if (transparent)
+            std::fill(fb->fbmem, fb->fbmem + fb->width * fb->height, TRANSPARENT_KEY);
+        else
+            fb->clear_screen();
+        content.x0 = content.y0 = INT_MAX;
+        content.x1 = content.y1 = INT_MIN;
+    }
+    // Clear part of a layer (to transparent or white)
+    void clear(int x, int y, int w, int h);
+    bool has_content() { return content.x0 < content.x1 && content.y0 < content.y1; }
+    void add_content(int x0, int y0, int x1, int y1)
+    {
+        content.x0 = std::max(0, std::min(content.x0, x0));
+        content.y0 = std::max(0, std::min(content.y0, y0));
+        content.x1 = std::min(fb->width, std::max(content.x1, x1));
+        content.y1 = std::min(fb->height, std::max(content.y1, y1));
+    }
 };
 
+// Find the bounding box of non-white pixels in rect (shrinks rect in place).
+// Returns false if there aren't any.
+bool scan_content(framebuffer::FB * fb, framebuffer::FBRect & rect);
+
+// Ordered (2x2 Bayer) dither of grays to black and white. (x, y) is where
+// src[0] is in the layer, which sets the phase of the pattern; src and dest
+// may be the same.
+void dither_row(const remarkable_color * src, remarkable_color * dest, int n, int x, int y);
+// Dither part of a framebuffer in place, the same way a canvas does when it
+// presents it
+void dither_rect(framebuffer::FB * fb, int x, int y, int w, int h);
+
 class Canvas: public ui::Widget {
 public:
     int trans_x = 0;
     int trans_y = 0;
     bool full_refresh = false;
+    // Layers hold undithered grays, and are dithered as they're copied to
+    // the screen (only the damaged part, and once however many primitives
+    // overlap it)
+    bool dither = false;
+
+    // Ghosting is tracked per tile: each partial update adds the fraction of
+    // the tile that changed, weighted by how far the gray level moved. Tiles
+    // over budget get a GC16 refresh once the user is idle. 0 = disabled.
+    static const int GHOST_TILE_SIZE = 64;
+    static const int GHOST_IDLE_DELAY = 2000;
+    float ghosting_budget = 0;
 
     Canvas(int x, int y, int w, int h);
     virtual ~Canvas();
 
     void render();
+    // Something else has drawn over the canvas; re-composite all of it
+    void invalidate() { full_damage = true; dirty = 1; }
+
+    // The screen has had a full refresh
+    void reset_ghosting() { std::fill(ghosting.begin(), ghosting.end(), 0.f); }
+    void on_mouse_down(input::SynMotionEvent & ev) { schedule_deghost(); }
 
     // translation functions
     void translate(int tx, int ty) { trans_x = tx; trans_y = ty; }
@@ -39,12 +104,42 @@ public:
     int screen_y(int y) { return y + trans_y + this->y; }
 
     // Layer access
-    Layer * add_layer()
+    // Layer 0 is the opaque base layer; layers added on top are composited
+    // over it, skipping TRANSPARENT_KEY pixels.
+    Layer * add_layer(bool transparent = true)
     {
-        layers.push_back(new Layer(this->w, this->h));
-        return layers[layers.size()];
+        layers.push_back(new Layer(this->w, this->h, transparent));
+        return layers.back();
     }
+    int num_layers() { return layers.size(); }
     Layer * layer(int n) { return layers[n]; }
+    // Transparent layer for transient drawing (created on first use)
+    Layer * overlay()
+    {
+        if (layers.size() < 2)
+            add_layer(true);
+        return layers[1];
+    }
+    // Size the layers to just the area that's drawn on (at trans_x,
+    // trans_y), rather than the whole canvas. This clears them.
+    void resize_layers(int w, int h)
+    {
+        w = std::max(1, std::min(w, this->w));
+        h = std::max(1, std::min(h, this->h));
+        for (auto l : layers)
+            l->resize(w, h);
+        invalidate();
+    }
+    // Replace layer n, returning the old one (now owned by the caller). Any
+    // overlays belonged to the old layer, so they are cleared.
+    Layer * swap_layer(int n, Layer * new_layer)
+    {
+        std::swap(layers[n], new_layer);
+        for (size_t i = 1; i < layers.size(); i++)
+            layers[i]->resize(layers[0]->fb->width, layers[0]->fb->height);
+        invalidate();
+        return new_layer;
+    }
     framebuffer::FB * drawfb(int n) { return layer(n)->drawfb; }
 
     // Shortcuts to the base layer
@@ -55,6 +150,16 @@ public:
 
 private:
     std::vector<Layer*> layers;
+
+    bool full_damage = true;
+
+    int ghost_cols, ghost_rows;
+    std::vector<float> ghosting;
+    ui::TimerPtr deghost_timer;
+    void copy_to_screen(const framebuffer::FBRect & rect);
+    void clear_margins();
+    void schedule_deghost();
+    void deghost();
 };
 
 #endif // RMP_UI_CANVAS_HPP
@@ -8,15 +8,38 @@
 
 class Background : public ui::Widget {
 public:
-    using ui::Widget::Widget;
+    PixelCache * cache;
+
+    Background(int x, int y, int w, int h, PixelCache * cache)
+        : ui::Widget(x, y, w, h), cache(cache)
+    {
+    }
 
     void render()
     {
-        fb->draw_rect(x, y, w, h, WHITE);   // background
-        fb->draw_rect(x-4, y, 4, h, BLACK); // border
+        if (cache->valid) {
+            cache->restore(fb);
+        } else {
+            fb->draw_rect(x, y, w, h, WHITE);   // background
+            fb->draw_rect(x-4, y, 4, h, BLACK); // border
+        }
     }
 };
 
+const int WRAP_WIDTH = 32;
+
+std::string preset_label(const std::string & title, bool selected)
+{
+    return selected ? "» " + title + " «" : "  " + title + "  ";
+}
+
+std::string hard_wrap(std::string t)
+{
+    for (size_t i = WRAP_WIDTH; i < t.size(); i += WRAP_WIDTH+1)
+        t.insert(i, "\n");
+    return t;
+}
+
 void draw_hamburger(framebuffer::FB * fb, int x, int y, int w, int h,
                     remarkable_color color = BLACK)
 {
@@ -57,19 +80,23 @@ public:
 };
 
 GameMenu::GameMenu(midend * me, const game *g, int x, int y, int w, int h)
+    : me(me)
 {
     scene = ui::make_scene();
     scene->on_hide += [=](auto &ev) {
         this->on_hide(ev);
     };
 
-    scene->add(new Background(x, y, w, h));
+    // include the border
+    cache.set_rect(x-4, y, w+4, h);
+    scene->add(new Background(x, y, w, h, &cache));
 
     auto layout = ui::VerticalLayout(x, y, w, h, scene);
     ui::Stylesheet btn_style = ui::Stylesheet().justify_left().valign_middle();
 
     auto add_button = [=, &layout](std::string title, int height=75) {
-        auto button = new ui::Button(0, 0, w, height, title);
+        auto button = new MenuButton(0, 0, w, height, title);
+        button->cache = &cache;
         button->x_padding = 20;
         button->set_style(btn_style);
         button->mouse.click += [=](auto &ev) {
@@ -109,15 +136,13 @@ GameMenu::GameMenu(midend * me, const game *g, int x, int y, int w, int h)
     layout.pack_start(presets_header, 30);
 
     auto menu_cfg = midend_get_presets(me, NULL);
-    int preset_id = midend_which_preset(me);
+    current_preset = midend_which_preset(me);
     for (int i = 0; i < menu_cfg->n_entries; i++) {
         auto entry = menu_cfg->entries[i];
-        std::string name = entry.title;
-        if (entry.id == preset_id)
-            name = "» " + name + " «";
-        else
-            name = "  " + name + "  ";
-        auto btn = add_button(name);
+        auto btn = add_button(preset_label(entry.title, entry.id == current_preset));
+        preset_btns.push_back(btn);
+        preset_titles.push_back(entry.title);
+        preset_ids.push_back(entry.id);
         layout.pack_start(btn);
         btn->mouse.click += [=](auto &ev) {
             int idx = i;
@@ -132,24 +157,69 @@ GameMenu::GameMenu(midend * me, const game *g, int x, int y, int w, int h)
     layout.pack_end(help_btn);
 
     // Game id and seed
-    auto hard_wrapped_text = [=](std::string t) {
-        int break_point = 32;
-        for (size_t i = break_point; i < t.size(); i += break_point+1)
-            t.insert(i, "\n");
-        auto text = new ui::MultiText(8, 0, w-8, 500, t);
-        text->set_style(ui::Stylesheet().font_size(22));
-        int lines = 1 + t.size() / (break_point + 1);
-        text->h = lines * text->style.font_size * text->style.line_height;
-        return text;
-    };
     char * id = midend_get_game_id(me);
     if (id != NULL) {
-        layout.pack_end(hard_wrapped_text(std::string("id=") + id), 10);
+        layout.pack_end(game_id = wrapped_text("id=", id, w), 10);
         sfree(id);
     }
     char * seed = midend_get_random_seed(me);
     if (seed != NULL) {
-        layout.pack_end(hard_wrapped_text(std::string("seed=") + seed), 10);
+        layout.pack_end(game_seed = wrapped_text("seed=", seed, w), 10);
         sfree(seed);
     }
+
+    // Save everything to the cache once it has been drawn
+    scene->add(new CacheCapture(&cache));
+}
+
+GameMenu::MenuText * GameMenu::wrapped_text(const std::string & label,
+                                            const char * value, int w)
+{
+    std::string t = hard_wrap(label + value);
+    auto text = new MenuText(8, 0, w-8, 500, t);
+    text->cache = &cache;
+    text->set_style(ui::Stylesheet().font_size(22));
+    int lines = 1 + t.size() / (WRAP_WIDTH + 1);
+    text->h = lines * text->style.font_size * text->style.line_height;
+    return text;
+}
+
+bool GameMenu::update_wrapped_text(MenuText * text, const std::string & label,
+                                   char * value)
+{
+    if ((text == nullptr) != (value == NULL)) {
+        sfree(value);
+        return false;
+    }
+    if (text == nullptr)
+        return true;
+    std::string t = hard_wrap(label + value);
+    sfree(value);
+    if (t == text->text)
+        return true;
+    // the layout is fixed, so we can only update text with the same height
+    if (std::count(t.begin(), t.end(), '\n')
+            != std::count(text->text.begin(), text->text.end(), '\n'))
+        return false;
+    text->text = t;
+    text->invalidate();
+    return true;
+}
+
+bool GameMenu::update()
+{
+    int preset_id = midend_which_preset(me);
+    if (preset_id != current_preset) {
+        for (size_t i = 0; i < preset_btns.size(); i++) {
+            bool was_selected = preset_ids[i] == current_preset;
+            bool selected = preset_ids[i] == preset_id;
+            if (selected != was_selected) {
+                preset_btns[i]->text = preset_label(preset_titles[i], selected);
+                preset_btns[i]->invalidate();
+            }
+        }
+        current_preset = preset_id;
+    }
+    return update_wrapped_text(game_id, "id=", midend_get_game_id(me))
+        && update_wrapped_text(game_seed, "seed=", midend_get_random_seed(me));
 }
@@ -1,9 +1,13 @@
 #ifndef RMP_GAME_MENU_HPP
 #define RMP_GAME_MENU_HPP
 
+#include <string>
+#include <vector>
+
 #include <rmkit.h>
 
 #include "puzzles.hpp"
+#include "ui/pixel_cache.hpp"
 
 class GameMenu {
 public:
@@ -13,29 +17,47 @@ public:
         void render();
     };
 
+    typedef CachedMixin<ui::Button> MenuButton;
+    typedef CachedMixin<ui::MultiText> MenuText;
+
     ui::Scene scene;
+    midend * me;
 
     ui::Widget * background = nullptr;
 
-    ui::Button * new_game_btn = nullptr;
-    ui::Button * restart_btn = nullptr;
-    ui::Button * solve_btn = nullptr;
-    ui::Button * help_btn = nullptr;
-    ui::Text * game_id = nullptr;
-    ui::Text * game_seed = nullptr;
+    MenuButton * new_game_btn = nullptr;
+    MenuButton * restart_btn = nullptr;
+    MenuButton * solve_btn = nullptr;
+    MenuButton * help_btn = nullptr;
+    MenuText * game_id = nullptr;
+    MenuText * game_seed = nullptr;
 
     GameMenu(midend *me, const game *g, int x, int y, int w, int h);
 
+    // Update the preset highlight and game id / seed for the current game.
+    // Returns false if the layout has changed and the menu needs rebuilding.
+    bool update();
+
     void show()
     {
+        // Once the menu has been drawn, showing it is a single blit
         ui::MainLoop::show_overlay(scene);
-        ui::MainLoop::full_refresh();
     }
     bool is_shown() { return scene == ui::MainLoop::overlay; }
 
     PLS_DEFINE_SIGNAL(PRESET_EVENT, int);
     PRESET_EVENT preset_selected;
     ui::InnerScene::DIALOG_VIS_EVENT on_hide;
+
+protected:
+    PixelCache cache;
+    std::vector<MenuButton *> preset_btns;
+    std::vector<std::string> preset_titles;
+    std::vector<int> preset_ids;
+    int current_preset = -1;
+
+    MenuText * wrapped_text(const std::string & label, const char * value, int w);
+    bool update_wrapped_text(MenuText * text, const std::string & label, char * value);
 };
 
 
@@ -1,16 +1,33 @@
 #include "game_scene.hpp"
 
 #include <chrono>
+#include <cmath>
 #include <fstream>
 #include <tuple>
 
 #include <rmkit.h>
 
+#include "alloc.hpp"
 #include "debug.hpp"
+#include "layout_cache.hpp"
 #include "puzzles.hpp"
 #include "ui/game_menu.hpp"
+#include "worker.hpp"
 
+// Minimum time between animation frames; frames are further paced by the
+// panel actually finishing the previous update.
 constexpr int TIMER_INTERVAL = 100;
+// Number of games (besides the current one) to keep in memory
+constexpr size_t MAX_LIVE_GAMES = 3;
+// Only show the solve dialog for solves that take longer than this
+constexpr int SOLVE_DIALOG_DELAY = 300;
+// Solve speculatively after the player has been idle this long
+constexpr int SPECULATIVE_SOLVE_DELAY = 3000;
+// Saves wait until the player has stopped making moves for this long
+constexpr int SAVE_DELAY = 2000;
+// After this long without input, the game clock stops waking us up every
+// second; it catches up at the next input
+constexpr int IDLE_CLOCK_TIMEOUT = 60000;
 
 GameScene::GameScene() : frontend()
 {
@@ -27,7 +44,7 @@ GameScene::GameScene() : frontend()
 
     // Status bar
     auto status_style = ui::Stylesheet().justify_left().valign_middle();
-    status_text = new ui::Text(20, 0, w - 40, 80, "");
+    status_text = new StatusBar(20, 0, w - 40, 80);
     status_text->set_style(status_style);
     v0.pack_end(status_text);
 
@@ -47,6 +64,7 @@ GameScene::GameScene() : frontend()
     controls_btn->mouse.click += [=](auto &ev) {
         controls_btn->set_image(paths::icon(
                     controls_btn->is_toggled ? "controls-swapped" : "controls"));
+        controls_btn->invalidate();
         show_controls();
     };
     undo_btn->mouse.click += [=](auto &ev) {
@@ -88,11 +106,15 @@ void GameScene::build_toolbar()
         int tb_h = 100;
         ui::Stylesheet tool_style = ui::Stylesheet().border_bottom();
 
+        toolbar_cache.set_rect(0, 0, framebuffer::get()->width, tb_h);
+        toolbar.push_back(new CacheRestore(&toolbar_cache));
+        scene->add(toolbar.back());
+
         back_btn = new IconButton(0, 0, 110, tb_h, paths::icon("back"));
         back_btn->set_style(tool_style);
         scene->add(back_btn);
 
-        menu_btn = new GameMenu::Button(0, 0, 100, tb_h, "");
+        menu_btn = new CachedMixin<GameMenu::Button>(0, 0, 100, tb_h, "");
         menu_btn->set_style(tool_style);
         scene->add(menu_btn);
 
@@ -108,16 +130,31 @@ void GameScene::build_toolbar()
         controls_btn->set_style(tool_style);
         scene->add(controls_btn);
 
-        new_game_btn = new ui::Button(0, 0, 175, tb_h, "New game");
+        new_game_btn = new CachedMixin<ui::Button>(0, 0, 175, tb_h, "New game");
         new_game_btn->set_style(tool_style);
         scene->add(new_game_btn);
 
         // whatever's left goes to the title
-        game_title = new ui::Text(0, 0, 600, tb_h, "");
+        game_title = new CachedMixin<ui::Text>(0, 0, 600, tb_h, "");
         game_title->set_style(ui::Stylesheet().justify_left().valign_middle()
                               .border_bottom().font_size(50));
         scene->add(game_title);
+
+        back_btn->cache = &toolbar_cache;
+        menu_btn->cache = &toolbar_cache;
+        redo_btn->cache = &toolbar_cache;
+        undo_btn->cache = &toolbar_cache;
+        controls_btn->cache = &toolbar_cache;
+        new_game_btn->cache = &toolbar_cache;
+        game_title->cache = &toolbar_cache;
+        // Save the toolbar once it has been drawn
+        toolbar.push_back(new CacheCapture(&toolbar_cache));
+        scene->add(toolbar.back());
+        toolbar.insert(toolbar.end() - 1, { back_btn, menu_btn, redo_btn, undo_btn,
+                                            controls_btn, new_game_btn, game_title });
     }
+    int old_title_x = game_title->x;
+    int old_title_w = game_title->w;
 
     // Pack toolbar items
     back_btn->x = 0;
@@ -137,6 +174,20 @@ void GameScene::build_toolbar()
     layout_end(controls_btn);
     layout_end(new_game_btn);
     game_title->w = right - game_title->x;
+    // Any change to the buttons changes the space left for the title
+    if (game_title->x != old_title_x || game_title->w != old_title_w) {
+        toolbar_cache.invalidate();
+        for (auto w : toolbar)
+            w->dirty = 1;
+    }
+}
+
+void GameScene::set_title(const std::string & title)
+{
+    if (game_title->text != title) {
+        game_title->text = title;
+        game_title->invalidate();
+    }
 }
 
 void GameScene::show_controls(int timeout)
@@ -184,16 +235,21 @@ void GameScene::show_menu()
 
 GameMenu* GameScene::build_menu(int x, int y, int w, int h)
 {
-    if (game_menu)
+    // The menu is kept around between shows; only rebuild it for a new game
+    // (or if the game id no longer fits).
+    if (game_menu && game_menu->me == me && menu_game == ourgame
+            && menu_generation == midend_generation && game_menu->update())
         return game_menu.get();
 
     game_menu = std::make_unique<GameMenu>(me, ourgame, x, y, w, h);
+    menu_game = ourgame;
+    menu_generation = midend_generation;
     game_menu->on_hide += [=](auto & _) {
+        canvas->invalidate();
         if (wants_full_refresh())
             canvas->full_refresh = true;
-        // Only destroy the overlay if it's the game menu's scene
+        // Only hide the overlay if it's the game menu's scene
         ui::MainLoop::hide_overlay(game_menu->scene);
-        game_menu = nullptr;
     };
 
     game_menu->new_game_btn->mouse.click += [=](auto &ev) {
@@ -204,12 +260,7 @@ GameMenu* GameScene::build_menu(int x, int y, int w, int h)
     };
     if (game_menu->solve_btn) {
         game_menu->solve_btn->mouse.click += [=](auto &ev) {
-            const char *err = midend_solve(me);
-            if (err != NULL) {
-                std::string msg = "Solve error: ";
-                msg += err;
-                status_bar(msg.c_str());
-            }
+            solve();
         };
     }
     game_menu->preset_selected += [=](int idx) {
@@ -227,8 +278,12 @@ HelpDialog* GameScene::build_help()
     if (help_dlg)
         return help_dlg.get();
 
-    help_dlg = std::make_unique<HelpDialog>(800, 1200);
+    // Help pages are as tall as will fit on the screen
+    int w, h;
+    std::tie(w, h) = framebuffer::get()->get_display_size();
+    help_dlg = std::make_unique<HelpDialog>(std::min(w - 200, 1000), h - 200);
     help_dlg->on_hide += [=](auto & _) {
+        canvas->invalidate();
         if (wants_full_refresh())
             canvas->full_refresh = true;
         // Only destroy the overlay if it's the dialog's scene
@@ -313,8 +368,11 @@ void GameScene::init_input_handlers()
     canvas->gestures.set_touch_threshold(config.touch_threshold);
 
     // Swap controls button
-    controls_btn->is_toggled = false;
-    controls_btn->set_image(paths::icon("controls"));
+    if (controls_btn->is_toggled) {
+        controls_btn->is_toggled = false;
+        controls_btn->set_image(paths::icon("controls"));
+        controls_btn->invalidate();
+    }
     if (long_down > 0 && long_down != short_down)
         controls_btn->show();
     else
@@ -335,13 +393,111 @@ void GameScene::handle_puzzle_key(int key_id)
 
 void GameScene::handle_puzzle_key(int x, int y, int key_id)
 {
-    midend_process_key(me, x, y, key_id);
+    wake_clock();
+    game_state * prev_state = get_game_state();
+    if (recorder)
+        recorder->key(x, y, key_id);
+    {
+        AllocScope scope(ourgame, AllocPhase::MOVE);
+        midend_process_key(me, x, y, key_id);
+    }
     debugf("process key %4d, %4d, %d\n", x, y, key_id);
+    skip_animations();
+    // Any solve in progress is for the old state (which may have been freed)
+    if (get_game_state() != prev_state) {
+        schedule_speculative_solve();
+        schedule_save();
+    }
+}
+
+// Solving
+void GameScene::solve()
+{
+    game_state * state = get_game_state();
+    if (solve_job && solve_job->me == me && solve_job->state == state) {
+        // A speculative solve for this state is done, or on its way
+        solve_requested = true;
+        if (solve_job->done) {
+            finish_solve();
+            return;
+        }
+    } else {
+        cancel_solve();
+        solve_requested = true;
+        start_solve_job();
+    }
+
+    if (solve_timer)
+        ui::cancel_timer(solve_timer);
+    solve_timer = ui::set_timeout([=]() {
+        solve_timer = nullptr;
+        if (!solve_dlg) {
+            solve_dlg = std::make_unique<SolveDialog>(500, 300);
+            solve_dlg->cancel_btn->mouse.click += [=](auto &ev) {
+                cancel_solve();
+            };
+            solve_dlg->on_hide += [=](auto & _) {
+                canvas->invalidate();
+            };
+        }
+        solve_dlg->show();
+    }, SOLVE_DIALOG_DELAY);
+}
+
+void GameScene::start_solve_job()
+{
+    if (get_game_state() == NULL)
+        return;
+    solve_job = start_solve(me, [=](std::shared_ptr<SolveJob> job) {
+        if (job == solve_job && solve_requested)
+            finish_solve();
+    });
+}
+
+void GameScene::finish_solve()
+{
+    std::shared_ptr<SolveJob> job = solve_job;
+    cancel_solve();
+    const char * err = job->ok ? apply_solution(me, job->move) : job->error.c_str();
+    if (err != NULL) {
+        std::string msg = "Solve error: ";
+        msg += err;
+        status_bar(msg.c_str());
+    }
+    skip_animations();
+    record_game();
+    schedule_save();
+}
+
+void GameScene::cancel_solve()
+{
+    if (solve_job) {
+        solve_job->cancelled = true;
+        solve_job = nullptr;
+    }
+    solve_requested = false;
+    if (solve_timer) {
+        ui::cancel_timer(solve_timer);
+        solve_timer = nullptr;
+    }
+    if (solve_dlg)
+        solve_dlg->hide();
+}
+
+void GameScene::schedule_speculative_solve()
+{
+    cancel_solve();
+    if (!config.speculative_solve || !ourgame->can_solve || midend_status(me) != 0)
+        return;
+    solve_timer = ui::set_timeout([=]() {
+        solve_timer = nullptr;
+        start_solve_job();
+    }, SPECULATIVE_SOLVE_DELAY);
 }
 
 void GameScene::check_solved()
 {
-    if (game_timer) return;
+    if (timer_running) return;
     int status = midend_status(me);
     if (status == last_status)
         return;
@@ -375,23 +531,55 @@ bool GameScene::wants_full_refresh()
     else if (me->nstates == 1)
         return config.full_refresh_new;
     else
-        return config.full_refresh_solving;
+        return false; // Canvas cleans up ghosting tile by tile
+}
+
+// Prefer the smallest border (in 100px steps, up to 700px) that brings the
+// tile size down to max_tilesize, unless that goes below min_tilesize.
+// Tile size only shrinks as the border grows, so binary search for it.
+int GameScene::find_border(const std::function<void(int)> & set_border)
+{
+    const int STEP = 100;
+    const int MAX_STEPS = 7;
+    // first step that's small enough, or too small
+    int limit = std::max(config.max_tilesize, config.min_tilesize - 1);
+    int tilesizes[MAX_STEPS + 1] = {};
+    auto tilesize = [&](int step) {
+        if (tilesizes[step] == 0) {
+            set_border(step * STEP);
+            tilesizes[step] = midend_tilesize(me);
+        }
+        return tilesizes[step];
+    };
+    int lo = 1, hi = MAX_STEPS;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (tilesize(mid) <= limit)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    // we went one too far
+    if (tilesize(lo) < config.min_tilesize)
+        return (lo - 1) * STEP;
+    return lo * STEP;
 }
 
 void GameScene::init_game()
 {
     last_status = midend_status(me);
-    game_title->text = std::string(" ") + ourgame->name;
+    set_title(std::string(" ") + ourgame->name);
 
     // Trigger a full refresh on the next canvas render
-    canvas->drawfb()->clear_screen();
+    drawer->clear();
     if (wants_full_refresh())
         canvas->full_refresh = true;
 
     // resize and center the canvas
-    auto set_border = [=](int border) {
-        int w = canvas->w - border;
-        int h = canvas->h - border;
+    int w, h;
+    auto set_border = [&](int border) {
+        w = canvas->w - border;
+        h = canvas->h - border;
         debugf("midend_size(%p, %d, %d, false)", (void*)me, w, h);
         midend_size(me, &w, &h, /* user_size = */ true);
         debugf(" => (%d, %d)\n", w, h);
@@ -401,29 +589,36 @@ void GameScene::init_game()
     if (config.fullscreen) {
         set_border(0);
     } else {
-        // prefer a 100px border unless we go below min_tilesize
-        for (int border = 100; border < 800; border += 100) {
-            set_border(border);
-            int tilesize = midend_tilesize(me);
-            // we went one too far
-            if (tilesize < config.min_tilesize) {
-                set_border(std::max(0, border - 100));
-                break;
-            }
-            // we've gone far enough
-            if (tilesize <= config.max_tilesize)
-                break;
+        game_params * params = midend_get_current_params(me);
+        std::string key = LayoutCache::key(ourgame, params, canvas->w, canvas->h, config);
+        ourgame->free_params(params);
+        int border;
+        if (!layout_cache().get(key, border)) {
+            border = find_border(set_border);
+            layout_cache().set(key, border);
         }
+        set_border(border);
     }
 
+    // Only the puzzle itself needs backing store
+    canvas->resize_layers(w, h);
+
     midend_redraw(me);
-    ui::MainLoop::refresh();
-    ui::MainLoop::redraw();
+    if (is_shown()) { // not when preloading
+        // Only the canvas has changed; the title re-renders itself if needed
+        canvas->invalidate();
+        ui::MainLoop::redraw();
+    }
+    schedule_speculative_solve();
+    record_game();
 }
 
 void GameScene::new_game()
 {
-    midend_new_game(me);
+    {
+        AllocScope scope(ourgame, AllocPhase::GENERATE);
+        midend_new_game(me);
+    }
     status_bar("");
     init_game();
     save_state();
@@ -431,25 +626,165 @@ void GameScene::new_game()
 
 void GameScene::restart_game()
 {
-    midend_restart_game(me);
+    {
+        AllocScope scope(ourgame, AllocPhase::MOVE);
+        midend_restart_game(me);
+    }
+    skip_animations();
+    schedule_speculative_solve();
+    record_game();
     status_bar("");
     last_status = 0;
-    ui::MainLoop::refresh();
+    canvas->invalidate();
     ui::MainLoop::redraw();
     save_state();
 }
 
 void GameScene::set_game(const game * a_game)
 {
-    save_state();
-    init_midend(drawer.get(), a_game);
-    init_input_handlers();
-    if (! load_state())
-        new_game();
+    if (a_game == preloaded) {
+        // Already loaded; just start it up again
+        preloaded = NULL;
+        if (me->anim_time > 0 || me->flash_time > 0 || me->timing)
+            activate_timer();
+    } else {
+        load_game(a_game);
+    }
     // Show controls for a little longer the first time
     show_controls(3500);
 }
 
+void GameScene::preload(const game * a_game)
+{
+    if (a_game == ourgame)
+        return;
+    load_game(a_game);
+    // The clock shouldn't run until the game is actually showing
+    deactivate_timer();
+    preloaded = a_game;
+}
+
+void GameScene::load_game(const game * a_game)
+{
+    preloaded = NULL;
+    if (a_game == ourgame) {
+        // Reload from scratch (picks up any config changes)
+        save_state();
+        init_midend(drawer.get(), a_game);
+        midend_generation++;
+        canvas->ghosting_budget = config.ghosting_budget;
+        init_input_handlers();
+        if (! load_state())
+            new_game();
+        return;
+    }
+
+    // Is this game still live?
+    std::unique_ptr<LiveGame> next;
+    for (auto it = live_games.begin(); it != live_games.end(); ++it) {
+        if ((*it)->ourgame == a_game) {
+            next = std::move(*it);
+            live_games.erase(it);
+            break;
+        }
+    }
+
+    // Keep the current game around, and give it its own canvas layer
+    if (ourgame != NULL) {
+        save_state_async();
+        std::unique_ptr<LiveGame> prev = detach_game();
+        // (init_game sizes a new game's layer)
+        Layer * base = canvas->layer(0);
+        Layer * layer = next ? next->layer : new Layer(base->fb->width, base->fb->height);
+        if (next)
+            next->layer = NULL;
+        prev->layer = canvas->swap_layer(0, layer);
+        live_games.push_front(std::move(prev));
+        evict_live_games(MAX_LIVE_GAMES);
+    }
+
+    if (next) {
+        attach_game(std::move(next));
+    } else {
+        drawer = std::make_unique<PuzzleDrawer>(canvas);
+        init_midend(drawer.get(), a_game);
+        midend_generation++;
+        canvas->ghosting_budget = config.ghosting_budget;
+        init_input_handlers();
+        // An evicted game could still be writing its save file
+        background_queue().wait();
+        if (! load_state())
+            new_game();
+    }
+}
+
+std::unique_ptr<LiveGame> GameScene::detach_game()
+{
+    deactivate_timer();
+    cancel_solve();
+    if (save_timer) {
+        // the caller has saved already
+        ui::cancel_timer(save_timer);
+        save_timer = nullptr;
+    }
+    auto lg = std::make_unique<LiveGame>();
+    lg->ourgame = ourgame;
+    lg->me = me;
+    lg->config = config;
+    lg->drawer = std::move(drawer);
+    lg->trans_x = canvas->trans_x;
+    lg->trans_y = canvas->trans_y;
+    lg->status = status_text->text;
+    lg->last_status = last_status;
+    ourgame = NULL;
+    me = NULL;
+    return lg;
+}
+
+void GameScene::attach_game(std::unique_ptr<LiveGame> lg)
+{
+    ourgame = lg->ourgame;
+    me = lg->me;
+    midend_generation++;
+    config = lg->config;
+    drawer = std::move(lg->drawer);
+    if (lg->layer != NULL)
+        delete canvas->swap_layer(0, lg->layer);
+    canvas->translate(lg->trans_x, lg->trans_y);
+    last_status = lg->last_status;
+    // the LiveGame no longer owns any of this
+    lg->me = NULL;
+    lg->layer = NULL;
+
+    set_title(std::string(" ") + ourgame->name);
+    canvas->ghosting_budget = config.ghosting_budget;
+    init_input_handlers();
+    status_bar(lg->status.c_str());
+    // Resume any animation or game clock that was running
+    if (me->anim_time > 0 || me->flash_time > 0 || me->timing)
+        activate_timer();
+    schedule_speculative_solve();
+    record_game();
+}
+
+void GameScene::evict_live_games(size_t max_size)
+{
+    while (live_games.size() > max_size) {
+        std::unique_ptr<LiveGame> lg = std::move(live_games.back());
+        live_games.pop_back();
+        // Only the write happens in the background: the midend's states can
+        // share refcounts (without atomics) with a solve job's copies, which
+        // are freed on this thread.
+        if (save_enabled) {
+            std::string data = serialise(lg->me);
+            std::string filename = paths::game_save(lg->ourgame);
+            background_queue().add([=]() {
+                write_file(filename, data);
+            });
+        }
+    }
+}
+
 void GameScene::set_params(game_params * params)
 {
     midend_set_params(me, params);
@@ -468,9 +803,20 @@ bool GameScene::load_state(const std::string & filename)
     }
 }
 
+bool GameScene::load_state_data(const std::string & data)
+{
+    status_bar("");
+    if (load_from_string(data)) {
+        init_game();
+        return true;
+    } else {
+        return false;
+    }
+}
+
 bool GameScene::save_state(const std::string & filename)
 {
-    return save_to_file(filename);
+    return save_enabled && save_to_file(filename);
 }
 
 bool GameScene::load_state()
@@ -483,42 +829,217 @@ bool GameScene::save_state()
     return ourgame != NULL && save_state(paths::game_save(ourgame));
 }
 
+void GameScene::save_state_async()
+{
+    if (ourgame == NULL || !save_enabled)
+        return;
+    // Serialising is cheap, but writing to disk may not be
+    std::string data = serialise(me);
+    std::string filename = paths::game_save(ourgame);
+    background_queue().add([=]() {
+        write_file(filename, data);
+    });
+}
+
+void GameScene::schedule_save()
+{
+    if (save_timer)
+        ui::cancel_timer(save_timer);
+    save_timer = ui::set_timeout([=]() {
+        save_timer = nullptr;
+        save_state_async();
+    }, SAVE_DELAY);
+}
+
+void GameScene::flush_save()
+{
+    if (save_timer) {
+        ui::cancel_timer(save_timer);
+        save_timer = nullptr;
+        save_state_async();
+    }
+}
+
+void GameScene::record_game()
+{
+    if (recorder)
+        recorder->start_game(this);
+}
+
 // Puzzle frontend
 void GameScene::frontend_default_colour(float *output)
 {
     output[0] = output[1] = output[2] = 1.f;
 }
 
+// Waits for e-ink updates to complete, off the UI thread
+static WorkQueue & refresh_queue()
+{
+    static WorkQueue queue(1);
+    return queue;
+}
+
 void GameScene::activate_timer()
 {
-    if (game_timer) return;
+    if (timer_running) return;
+    timer_running = true;
     timer_prev = std::chrono::high_resolution_clock::now();
-    game_timer = ui::set_interval([=]() {
-        auto now = std::chrono::high_resolution_clock::now();
-        auto time_diff = now - timer_prev;
-        timer_prev = now;
-        midend_timer(me, std::chrono::duration<float>(time_diff).count());
-        // TODO: this shouldn't be necessary, but at least in rm2 this seems to
-        // help get the screen to actually flash
-        if (midend_status(me) != 0)
-            scene->refresh();
-    }, TIMER_INTERVAL);
+    pending_time = 0;
+    clock_idle = false;
+    last_input = std::chrono::steady_clock::now();
+    schedule_frame(std::max(TIMER_INTERVAL, (int)(1000 * next_frame_time())));
 }
 
 void GameScene::deactivate_timer()
 {
-    if (game_timer) {
-        ui::cancel_timer(game_timer);
-        game_timer = nullptr;
+    if (timer_running) {
+        timer_running = false;
+        clock_idle = false;
+        timer_generation++;
+        if (game_timer) {
+            ui::cancel_timer(game_timer);
+            game_timer = nullptr;
+        }
         if (is_shown())
             check_solved();
     }
 }
 
+void GameScene::wake_clock()
+{
+    last_input = std::chrono::steady_clock::now();
+    if (clock_idle) {
+        clock_idle = false;
+        schedule_frame(0); // timer_prev is from before the idle time
+    }
+}
+
+void GameScene::schedule_frame(int delay)
+{
+    game_timer = ui::set_timeout([=]() {
+        game_timer = nullptr;
+        timer_frame();
+    }, delay);
+}
+
+void GameScene::timer_frame()
+{
+    auto now = std::chrono::high_resolution_clock::now();
+    auto time_diff = now - timer_prev;
+    timer_prev = now;
+    pending_time += std::chrono::duration<float>(time_diff).count();
+    // Don't bother the midend until there's a frame the config wants drawn
+    float wait = next_frame_time();
+    if (wait > 0) {
+        schedule_frame(std::max(1, (int)(1000 * wait)));
+        return;
+    }
+    // If the panel was slow, this skips straight past any frames it missed
+    midend_timer(me, pending_time);
+    pending_time = 0;
+    // A move animation that finishes here can start a flash the config skips
+    skip_animations();
+    if (!timer_running)
+        return; // nothing left to animate
+
+    // Animations get frames as fast as the panel can show them, but the game
+    // clock only needs to tick over once a second.
+    int delay = std::max(TIMER_INTERVAL, (int)(1000 * next_frame_time()));
+    if (me->anim_time == 0 && me->flash_time == 0 && me->timing) {
+        if (std::chrono::steady_clock::now() - last_input
+                > std::chrono::milliseconds(IDLE_CLOCK_TIMEOUT)) {
+            // Nobody's watching; stop ticking until the next input
+            clock_idle = true;
+            present_frame();
+            return;
+        }
+        delay = std::max(TIMER_INTERVAL, (int)(1000 * (1 - std::fmod(me->elapsed, 1.f))));
+    }
+
+    uint32_t marker = present_frame();
+    if (marker == 0) {
+        schedule_frame(delay);
+        return;
+    }
+    // Don't draw the next frame until this one is on the screen
+    int generation = timer_generation;
+    refresh_queue().add([=]() {
+        framebuffer::get()->wait_for_redraw(marker);
+        run_on_ui_thread([=]() {
+            if (!timer_running || generation != timer_generation || game_timer)
+                return;
+            auto waited = std::chrono::high_resolution_clock::now() - now;
+            int waited_ms = std::chrono::duration_cast<std::chrono::milliseconds>(waited).count();
+            schedule_frame(std::max(0, delay - waited_ms));
+        });
+    });
+}
+
+float GameScene::next_frame_time()
+{
+    // Moves animate first, and then the flash (if any)
+    const Config::Animation * anim;
+    float pos, length;
+    if (me->anim_time > 0) {
+        anim = &config.move_animation;
+        pos = me->anim_pos;
+        length = me->anim_time;
+    } else if (me->flash_time > 0) {
+        anim = &config.flash_animation;
+        pos = me->flash_pos;
+        length = me->flash_time;
+    } else {
+        return 0; // just the game clock
+    }
+
+    float target;
+    switch (anim->mode) {
+    case Config::Animation::Mode::FINAL:
+        target = length;
+        break;
+    case Config::Animation::Mode::FRAMES: {
+        // the next evenly spaced frame after the last one drawn
+        float step = length / (anim->frames + 1);
+        target = std::min(length, step * (std::floor(pos / step) + 1));
+        break;
+    }
+    default:
+        return 0;
+    }
+    return std::max(0.f, target - (pos + pending_time));
+}
+
+void GameScene::skip_animations()
+{
+    // Setting the position to the end and passing no time finishes the
+    // animation without eating into any flash that it starts.
+    while (true) {
+        if (me->anim_time > 0
+                && config.move_animation.mode == Config::Animation::Mode::SKIP) {
+            me->anim_pos = me->anim_time;
+            midend_timer(me, 0);
+        } else if (me->anim_time == 0 && me->flash_time > 0
+                && config.flash_animation.mode == Config::Animation::Mode::SKIP) {
+            me->flash_pos = me->flash_time;
+            midend_timer(me, 0);
+        } else {
+            break;
+        }
+    }
+}
+
+uint32_t GameScene::present_frame()
+{
+    // Push the canvas to the screen now (instead of at the next redraw), so we
+    // get an update marker to wait on.
+    if (!canvas->dirty || !is_shown() || ui::MainLoop::overlay_is_visible())
+        return 0;
+    canvas->render();
+    canvas->dirty = 0;
+    return framebuffer::get()->redraw_screen();
+}
+
 void GameScene::status_bar(const char *text)
 {
-    // TODO: this doesn't actually clear all the existing text?
-    status_text->undraw();
-    status_text->text = text;
-    status_text->dirty = 1;
+    status_text->set_text(text);
 }
@@ -2,46 +2,87 @@
 #define RMP_GAME_SCENE_HPP
 
 #include <chrono>
+#include <functional>
+#include <list>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <rmkit.h>
 
 #include "puzzles.hpp"
+#include "session.hpp"
+#include "solver.hpp"
 #include "ui/button_mixin.hpp"
 #include "ui/canvas.hpp"
 #include "ui/fs_pixmap.hpp"
 #include "ui/game_menu.hpp"
 #include "ui/game_over.hpp"
 #include "ui/help.hpp"
+#include "ui/pixel_cache.hpp"
 #include "ui/puzzle_drawer.hpp"
+#include "ui/solve_dialog.hpp"
+#include "ui/status_bar.hpp"
 #include "ui/toast.hpp"
 
+// A recently played game that's kept alive in the background, so switching
+// back to it doesn't need to re-read config or save files, or redraw.
+struct LiveGame {
+    const game * ourgame = NULL;
+    midend * me = NULL;
+    Config config;
+    std::unique_ptr<PuzzleDrawer> drawer;
+    Layer * layer = NULL; // canvas contents, including any blitter backgrounds
+    int trans_x = 0, trans_y = 0;
+    std::string status;
+    int last_status = 0;
+
+    ~LiveGame()
+    {
+        // free the midend first, since its drawstate may own blitters
+        if (me != NULL)
+            midend_free(me);
+        drawer = nullptr;
+        delete layer;
+    }
+};
+
 class GameScene : public frontend {
 protected:
-    typedef ButtonMixin<FSPixmap> IconButton;
-    typedef ToggleButtonMixin<FSPixmap> ToggleIconButton;
+    typedef CachedMixin<ButtonMixin<FSPixmap>> IconButton;
+    typedef CachedMixin<ToggleButtonMixin<FSPixmap>> ToggleIconButton;
 
     // Main UI
     ui::Scene scene;
 
-    ui::Button * new_game_btn = nullptr;
+    // The toolbar only changes when a button is pressed, the game changes,
+    // or buttons are shown or hidden, so it is drawn from a cached strip
+    // whenever the scene is re-rendered.
+    PixelCache toolbar_cache;
+    std::vector<ui::Widget *> toolbar; // everything drawn in toolbar_cache
+    CachedMixin<ui::Button> * new_game_btn = nullptr;
     IconButton * back_btn = nullptr;
-    ui::Text * game_title = nullptr;
+    CachedMixin<ui::Text> * game_title = nullptr;
     ToggleIconButton * controls_btn = nullptr;
     IconButton * undo_btn = nullptr;
     IconButton * redo_btn = nullptr;
-    GameMenu::Button * menu_btn = nullptr;
+    CachedMixin<GameMenu::Button> * menu_btn = nullptr;
     void build_toolbar();
+    void set_title(const std::string & title);
 
     Toast * controls_toast = nullptr;
     void show_controls(int timeout = 2000);
 
     Canvas * canvas;
-    ui::Text * status_text;
+    StatusBar * status_text;
 
-    // Menu scene
+    // Menu scene. It's only reused for the same midend: a freed midend's
+    // address can come back for another game, so the menu is keyed on the
+    // game and a count of midend changes as well.
     std::unique_ptr<GameMenu> game_menu;
+    const game * menu_game = NULL;
+    int menu_generation = -1;
+    int midend_generation = 0; // bumped whenever me changes
     GameMenu* build_menu(int x, int y, int w, int h);
     void show_menu();
 
@@ -53,32 +94,86 @@ protected:
     std::unique_ptr<HelpDialog> help_dlg;
     HelpDialog* build_help();
 
+    // Solving (on a worker thread). A job may be started speculatively once
+    // the player is idle; pressing Solve then uses its result.
+    std::shared_ptr<SolveJob> solve_job;
+    bool solve_requested = false; // apply solve_job as soon as it's done
+    ui::TimerPtr solve_timer;     // idle delay, or delay before solve_dlg
+    std::unique_ptr<SolveDialog> solve_dlg;
+
+    ui::TimerPtr save_timer; // see schedule_save
+    void start_solve_job();
+    void finish_solve();
+    void cancel_solve();
+    void schedule_speculative_solve();
+
     // Puzzle frontend
     std::unique_ptr<PuzzleDrawer> drawer;
     std::chrono::high_resolution_clock::time_point timer_prev;
     ui::TimerPtr game_timer;
+    bool timer_running = false;
+    int timer_generation = 0; // ignores refresh completions from old timers
+    float pending_time = 0;   // time not yet passed to midend_timer
+    // Only the game clock is running, and it has stopped for lack of input
+    bool clock_idle = false;
+    std::chrono::steady_clock::time_point last_input;
+    void wake_clock();
+    float next_frame_time();
+    void skip_animations();
+    void schedule_frame(int delay);
+    void timer_frame();
+    uint32_t present_frame();
+
+    // Recently played games, most recent first (not including the current one)
+    std::list<std::unique_ptr<LiveGame>> live_games;
+    std::unique_ptr<LiveGame> detach_game();
+    void attach_game(std::unique_ptr<LiveGame> lg);
+    void load_game(const game * a_game);
+    const game * preloaded = NULL; // loaded, but not shown yet
+    void evict_live_games(size_t max_size);
 
 public:
     GameScene();
 
     ui::MOUSE_EVENT back_click;
 
-    void show()
+    // Session recording (opt-in) and replay
+    std::unique_ptr<SessionRecorder> recorder;
+    bool save_enabled = true; // false while replaying someone else's session
+    void record_game();
+
+    // refresh = false when the screen already shows the scene (resuming from
+    // a snapshot), so it's drawn over without a flashing refresh
+    void show(bool refresh = true)
     {
         ui::MainLoop::set_scene(scene);
-        ui::MainLoop::full_refresh();
+        if (refresh)
+            ui::MainLoop::full_refresh();
+        canvas->invalidate();
+        canvas->reset_ghosting();
     }
     bool is_shown() { return scene == ui::MainLoop::scene; }
 
     void set_game(const game * a_game);
+    // Load a game without showing it (e.g. while the chooser is up), so that
+    // selecting it is just a scene switch
+    void preload(const game * a_game);
     void set_params(game_params * params);
     void init_game();
+    int find_border(const std::function<void(int)> & set_border);
     void new_game();
     void restart_game();
+    void solve();
     bool load_state(const std::string & filename);
+    bool load_state_data(const std::string & data);
     bool save_state(const std::string & filename);
     bool load_state();
     bool save_state();
+    void save_state_async();
+    // Moves are saved once they stop for a moment; flush_save saves now
+    // instead if a save is waiting
+    void schedule_save();
+    void flush_save();
     game_state * get_game_state()
     {
         return me->statepos > 0 ? me->states[me->statepos-1].state : NULL;
@@ -93,11 +188,12 @@ public:
     void deactivate_timer();
     void status_bar(const char *text);
 
+    void handle_puzzle_key(int x, int y, int key_id);
+
 protected:
     // Puzzle event handlers
     void init_input_handlers();
     void handle_puzzle_key(int key_id);
-    void handle_puzzle_key(int x, int y, int key_id);
     void handle_canvas_event(input::SynMotionEvent & evt, int key_id);
 };
 
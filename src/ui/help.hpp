@@ -4,39 +4,224 @@
 #include <algorithm>
 #include <cctype>
 #include <fstream>
+#include <list>
+#include <map>
+#include <sstream>
 #include <string>
- 
+#include <tuple>
+#include <vector>
+
 #include <rmkit.h>
- 
+
 #include "paths.hpp"
 #include "puzzles.hpp"
-#include "ui/msg.hpp"
+#include "ui/pixel_cache.hpp"
+#include "ui/util.hpp"
+
+// Help text, wrapped and split into pages that fit the dialog
+struct HelpLayout {
+    std::string title;
+    std::vector<std::vector<std::string>> pages;
+};
+
+// One page of help text. Rendered pages are kept in a small cache, so
+// turning back to a page is a single blit.
+class HelpPage : public ui::Widget {
+public:
+    static const int CACHE_SIZE = 3;
+
+    const game * ourgame = NULL;
+    const std::vector<std::string> * lines = NULL;
+    int page = 0;
+    int line_height;
+
+    HelpPage(int x, int y, int w, int h) : ui::Widget(x, y, w, h)
+    {
+        set_style(ui::Stylesheet().font_size(34));
+        line_height = stbtext::get_line_height(style.font_size) * 1.5;
+    }
+
+    void set_page(const game * g, int n, const std::vector<std::string> * page_lines)
+    {
+        ourgame = g;
+        page = n;
+        lines = page_lines;
+        dirty = 1;
+    }
+
+    void render()
+    {
+        // Most recently used page goes at the front
+        for (auto it = cache.begin(); it != cache.end(); ++it) {
+            if (it->ourgame == ourgame && it->page == page) {
+                cache.splice(cache.begin(), cache, it);
+                cache.front().pixels.restore(fb);
+                return;
+            }
+        }
+
+        fb->draw_rect(x, y, w, h, WHITE);
+        if (lines != NULL) {
+            for (size_t i = 0; i < lines->size(); i++)
+                draw_colored_text(fb, x, y + i * line_height,
+                                  (*lines)[i].c_str(), style.font_size, BLACK);
+        }
+
+        if ((int)cache.size() >= CACHE_SIZE)
+            cache.pop_back();
+        cache.emplace_front();
+        cache.front().ourgame = ourgame;
+        cache.front().page = page;
+        cache.front().pixels.set_rect(x, y, w, h);
+        cache.front().pixels.capture(fb);
+    }
+
+protected:
+    struct CachedPage {
+        const game * ourgame;
+        int page;
+        PixelCache pixels;
+    };
+    std::list<CachedPage> cache;
+};
+
+class HelpDialog : public ui::DialogBase {
+protected:
+    ui::Text * title;
+    HelpPage * body;
+    ui::Button * prev_btn;
+    ui::Button * next_btn;
+    ui::Text * page_label;
+
+    const game * ourgame = NULL;
+    int page = 0;
+    // Layout is done once per game
+    std::map<const game *, HelpLayout> layouts;
 
-class HelpDialog : public SimpleMessageDialog {
 public:
-    using SimpleMessageDialog::SimpleMessageDialog;
+    HelpDialog(int w, int h) : ui::DialogBase(0, 0, w, h)
+    {
+        // Center the dialog once; its size never changes
+        int screen_w, screen_h;
+        std::tie(screen_w, screen_h) = framebuffer::get()->get_display_size();
+        x = (screen_w - w) / 2;
+        y = (screen_h - h) / 2;
+
+        int padding = 20;
+        int title_size = 50;
+        int btn_h = 100;
+        title = new ui::Text(x + padding, y + padding, w - 2*padding, title_size, "");
+        title->set_style(ui::Stylesheet().font_size(title_size));
+        body = new HelpPage(x + padding, y + 3*padding + title_size,
+                            w - 2*padding, h - 4*padding - title_size - btn_h);
+
+        int btn_y = y + h - btn_h;
+        prev_btn = new ui::Button(x, btn_y, 200, btn_h, "< Prev");
+        prev_btn->set_style(ui::Stylesheet().border_top());
+        next_btn = new ui::Button(x + w - 200, btn_y, 200, btn_h, "Next >");
+        next_btn->set_style(ui::Stylesheet().border_top());
+        page_label = new ui::Text(x + 200, btn_y, w - 400, btn_h, "");
+        page_label->set_style(ui::Stylesheet().justify_center().valign_middle()
+                              .border_top());
 
-    void load_game_help(const game * g)
+        prev_btn->mouse.click += [=](auto &ev) {
+            set_page(page - 1);
+        };
+        next_btn->mouse.click += [=](auto &ev) {
+            set_page(page + 1);
+        };
+    }
+
+    void build_dialog()
+    {
+        ui::Scene scene = create_scene();
+        scene->add(title);
+        scene->add(body);
+        scene->add(prev_btn);
+        scene->add(page_label);
+        scene->add(next_btn);
+    }
+
+    // Ignore -- the dialog is positioned in the constructor
+    void position_dialog() { }
+
+    const HelpLayout & get_layout(const game * g)
+    {
+        auto it = layouts.find(g);
+        if (it != layouts.end())
+            return it->second;
+        HelpLayout & layout = layouts[g];
+        load_game_help(g, layout);
+        return layout;
+    }
+
+    void load_game_help(const game * g, HelpLayout & layout)
     {
         std::string fname = paths::game_help(g);
         std::ifstream f(fname);
+        std::string text;
         if (f) {
             // First line is the title
-            std::getline(f, title->text);
+            std::getline(f, layout.title);
             f.ignore(100, '\n');
             // Rest (after a blank line) is the body
-            std::getline(f, body->text, '\0');
+            std::getline(f, text, '\0');
         } else {
-            title->text = g->name;
-            body->text = "Missing file: " + fname;
+            layout.title = g->name;
+            text = "Missing file: " + fname;
         }
         // upper-case the title
-        std::transform(title->text.begin(), title->text.end(), title->text.begin(), (int (*)(int))std::toupper);
+        std::transform(layout.title.begin(), layout.title.end(), layout.title.begin(), (int (*)(int))std::toupper);
+
+        // Wrap and paginate the body
+        int lines_per_page = std::max(1, body->h / body->line_height);
+        layout.pages.emplace_back();
+        auto add_line = [&](const std::string & line) {
+            if ((int)layout.pages.back().size() >= lines_per_page)
+                layout.pages.emplace_back();
+            layout.pages.back().push_back(line);
+        };
+        std::stringstream paragraphs(text);
+        std::string paragraph;
+        while (std::getline(paragraphs, paragraph)) {
+            std::stringstream words(paragraph);
+            std::string word, line;
+            while (words >> word) {
+                std::string next = line.empty() ? word : line + " " + word;
+                int width = stbtext::get_text_size(next, body->style.font_size).w;
+                if (width > body->w && !line.empty()) {
+                    add_line(line);
+                    line = word;
+                } else {
+                    line = next;
+                }
+            }
+            add_line(line);
+        }
+    }
+
+    void set_page(int n)
+    {
+        const HelpLayout & layout = get_layout(ourgame);
+        n = std::max(0, std::min<int>(n, layout.pages.size() - 1));
+        if (n == page && body->ourgame == ourgame)
+            return;
+        page = n;
+        body->set_page(ourgame, page, &layout.pages[page]);
+        page_label->undraw();
+        page_label->text = std::to_string(page + 1) + " / "
+                         + std::to_string(layout.pages.size());
+        page_label->dirty = 1;
     }
 
     void show(const game * g)
     {
-        load_game_help(g);
+        if (g != ourgame) {
+            ourgame = g;
+            page = -1;
+            title->text = get_layout(g).title;
+        }
+        set_page(std::max(0, page));
         ui::DialogBase::show();
     }
 };
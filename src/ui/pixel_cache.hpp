@@ -0,0 +1,146 @@
+#ifndef RMP_PIXEL_CACHE_HPP
+#define RMP_PIXEL_CACHE_HPP
+
+#include <algorithm>
+#include <vector>
+
+#include <rmkit.h>
+
+// A saved copy of a rectangle of the framebuffer, which can be blitted back
+// instead of re-rendering all the widgets that drew it.
+class PixelCache {
+public:
+    int x = 0, y = 0, w = 0, h = 0;
+    bool valid = false;
+
+    void set_rect(int x, int y, int w, int h)
+    {
+        this->x = x; this->y = y; this->w = w; this->h = h;
+        pixels.resize(w * h);
+        valid = false;
+    }
+
+    void invalidate() { valid = false; }
+
+    // Save the whole cached rect
+    void capture(framebuffer::FB * fb)
+    {
+        capture(fb, x, y, w, h);
+        valid = true;
+    }
+
+    // Update part of the cache after it has been redrawn
+    void capture(framebuffer::FB * fb, int rx, int ry, int rw, int rh)
+    {
+        if (!clip(rx, ry, rw, rh))
+            return;
+        for (int i = 0; i < rh; i++) {
+            auto src = &fb->fbmem[(ry + i)*fb->width + rx];
+            std::copy(src, src + rw, &pixels[(ry - y + i)*w + (rx - x)]);
+        }
+    }
+
+    // Blit the whole cached rect back to the framebuffer
+    void restore(framebuffer::FB * fb)
+    {
+        for (int i = 0; i < h; i++) {
+            auto src = &pixels[i*w];
+            std::copy(src, src + w, &fb->fbmem[(y + i)*fb->width + x]);
+        }
+        fb->update_dirty(fb->dirty_area, x, y);
+        fb->update_dirty(fb->dirty_area, x + w, y + h);
+        fb->dirty = 1;
+    }
+
+protected:
+    std::vector<remarkable_color> pixels;
+
+    // Clip a rect to the cached rect; returns false if nothing is left
+    bool clip(int & rx, int & ry, int & rw, int & rh)
+    {
+        int x1 = std::min(rx + rw, x + w);
+        int y1 = std::min(ry + rh, y + h);
+        rx = std::max(rx, x);
+        ry = std::max(ry, y);
+        rw = x1 - rx;
+        rh = y1 - ry;
+        return rw > 0 && rh > 0;
+    }
+};
+
+// Widget that only renders when its PixelCache is invalid, or when it has
+// changed since the cache was captured (in which case its area of the cache
+// is updated). Otherwise it relies on something else restoring the cache.
+template<typename T>
+class CachedMixin : public T {
+public:
+    using T::T;
+
+    PixelCache * cache = nullptr;
+    bool stale = true;
+
+    // Re-render this widget (only) at the next redraw
+    void invalidate()
+    {
+        stale = true;
+        this->dirty = 1;
+    }
+
+    void on_mouse_down(input::SynMotionEvent &ev) { invalidate(); T::on_mouse_down(ev); }
+    void on_mouse_up(input::SynMotionEvent &ev) { invalidate(); T::on_mouse_up(ev); }
+    void on_mouse_leave(input::SynMotionEvent &ev) { invalidate(); T::on_mouse_leave(ev); }
+    void on_mouse_enter(input::SynMotionEvent &ev) { invalidate(); T::on_mouse_enter(ev); }
+
+    void render()
+    {
+        if (cache == nullptr || !cache->valid) {
+            T::render();
+            stale = false;
+        } else if (stale) {
+            this->fb->draw_rect(this->x, this->y, this->w, this->h, WHITE);
+            T::render();
+            cache->capture(this->fb, this->x, this->y, this->w, this->h);
+            stale = false;
+        }
+    }
+};
+
+// Add this before the cached widgets: it blits the cache back if it's valid,
+// or clears the area so the widgets can render from scratch.
+class CacheRestore : public ui::Widget {
+public:
+    PixelCache * cache;
+
+    CacheRestore(PixelCache * cache)
+        : ui::Widget(cache->x, cache->y, cache->w, cache->h), cache(cache)
+    {
+    }
+
+    void render()
+    {
+        if (cache->valid)
+            cache->restore(fb);
+        else
+            fb->draw_rect(x, y, w, h, WHITE);
+    }
+};
+
+// Add this last in a scene: once everything else has rendered, it saves the
+// result to the cache.
+class CacheCapture : public ui::Widget {
+public:
+    PixelCache * cache;
+
+    CacheCapture(PixelCache * cache)
+        : ui::Widget(cache->x, cache->y, cache->w, cache->h), cache(cache)
+    {
+    }
+
+    void render()
+    {
+        if (!cache->valid)
+            cache->capture(fb);
+    }
+};
+
+#endif // RMP_PIXEL_CACHE_HPP
@@ -1,8 +1,18 @@
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+#include "alloc.hpp"
 #include "config.hpp"
+#include "debug.hpp"
 #include "puzzles.hpp"
 #include "ui/canvas.hpp"
 #include "ui/puzzle_drawer.hpp"
 #include "ui/util.hpp"
+#include "worker.hpp"
 
 remarkable_color PuzzleDrawer::rm_color(int idx)
 {
@@ -14,41 +24,11 @@ remarkable_color PuzzleDrawer::rm_color(int idx)
     return ((r & 0b11111000) << 8) | ((g & 0b11111100) << 3) | (b >> 3);
 }
 
-void PuzzleDrawer::draw_text(int x, int y, int fonttype,
-                             int fontsize, int align, int colour,
-                             const char *text)
+void PuzzleDrawer::add_content(int x0, int y0, int x1, int y1, int colour)
 {
-    // Render text to a bitmap (from ui/util)
-    remarkable_color c = rm_color(colour);
-    remarkable_color alpha = c == WHITE ? BLACK : WHITE;
-    image_data image = render_colored_text(text, fontsize, rm_color(colour));
-
-    // Align the text
-    // fontsize should be close to the height (in pixels) of the text.
-    if (align & ALIGN_VNORMAL) {
-        y -= fontsize;
-    } else if (align  & ALIGN_VCENTRE) {
-        y -= fontsize / 2;
-    }
-    if (align & ALIGN_HCENTRE) {
-        x -= image.w / 2;
-    } else if (align & ALIGN_HRIGHT) {
-        x -= image.w;
-    }
-
-    // Actually draw the bitmap
-    canvas->drawfb()->draw_bitmap(image, x, y, alpha);
-    free(image.buffer);
-}
-
-void PuzzleDrawer::draw_rect(int x, int y, int w, int h, int colour)
-{
-    canvas->drawfb()->draw_rect(x, y, w, h, rm_color(colour));
-}
-
-void PuzzleDrawer::draw_line(int x1, int y1, int x2, int y2, int colour)
-{
-    canvas->drawfb()->draw_line(x1, y1, x2, y2, 1, rm_color(colour));
+    if (colour >= 0 && rm_color(colour) == WHITE)
+        return;
+    canvas->layer(target)->add_content(x0, y0, x1, y1);
 }
 
 // Also from https://github.com/SteffenBauer/PocketPuzzles/blob/be8f3312341ac33c937ff0263b7c62fd3ae575cc/frontend/game.c#L82
@@ -80,16 +60,19 @@ void extendrow(int y, int x1, int y1, int x2, int y2, int *minxptr, int *maxxptr
     if (*maxxptr < x) *maxxptr = x;
 }
 
-void PuzzleDrawer::draw_polygon(int *icoords, int npoints,
-                                int fillcolour, int outlinecolour)
-{
-    remarkable_color fill = rm_color(fillcolour);
-    remarkable_color outline = rm_color(outlinecolour);
+// == Replaying drawing operations ==
 
+// Draw a polygon to fb, with y coordinates offset by dy
+static void fill_polygon(framebuffer::FB * fb, const DrawOp & op, int dy)
+{
     // Snagged from the PocketReader port
     // https://github.com/SteffenBauer/PocketPuzzles/blob/be8f3312341ac33c937ff0263b7c62fd3ae575cc/frontend/game.c#L110-L150
     typedef struct { int x; int y;} MWPOINT;
-    MWPOINT *coords = (MWPOINT *)icoords;
+    std::vector<int> icoords(op.coords);
+    for (size_t i = 1; i < icoords.size(); i += 2)
+        icoords[i] -= dy;
+    MWPOINT *coords = (MWPOINT *)icoords.data();
+    int npoints = icoords.size() / 2;
 
     MWPOINT *pp;
     int miny;
@@ -98,9 +81,9 @@ void PuzzleDrawer::draw_polygon(int *icoords, int npoints,
     int maxx;
     int i;
 
-    if (fillcolour!=-1) {
-        if (npoints <= 0) return;
+    if (npoints <= 0) return;
 
+    if (op.filled) {
         pp = coords;
         miny = pp->y;
         maxy = pp->y;
@@ -108,6 +91,9 @@ void PuzzleDrawer::draw_polygon(int *icoords, int npoints,
             if (miny > pp->y) miny = pp->y;
             if (maxy < pp->y) maxy = pp->y;
         }
+        // Only rows that are in the framebuffer
+        miny = std::max(miny, 0);
+        maxy = std::min(maxy, fb->height - 1);
 
         for (; miny <= maxy; miny++) {
             minx = 32767;
@@ -118,45 +104,319 @@ void PuzzleDrawer::draw_polygon(int *icoords, int npoints,
             extendrow(miny, pp[0].x, pp[0].y, coords[0].x, coords[0].y, &minx, &maxx);
 
             if (minx <= maxx) {
-                canvas->drawfb()->draw_line(minx, miny, maxx, miny, 1, fill);
+                fb->draw_line(minx, miny, maxx, miny, 1, op.fill);
             }
         }
     }
 
     for (i = 0; i < npoints-1; i++) {
-        canvas->drawfb()->draw_line(coords[i].x, coords[i].y, coords[i+1].x, coords[i+1].y, 1, outline);
+        fb->draw_line(coords[i].x, coords[i].y, coords[i+1].x, coords[i+1].y, 1, op.colour);
     }
     // close the polygon
-    canvas->drawfb()->draw_line(coords[i].x, coords[i].y, coords[0].x, coords[0].y, 1, outline);
+    fb->draw_line(coords[i].x, coords[i].y, coords[0].x, coords[0].y, 1, op.colour);
+}
+
+// Draw op to fb, with y coordinates offset by dy. Clipping is up to the caller.
+static void replay(framebuffer::FB * fb, const DrawOp & op, int dy)
+{
+    switch (op.kind) {
+    case DrawOp::Kind::BITMAP:
+        fb->draw_bitmap(op.image, op.x, op.y - dy, op.fill);
+        break;
+    case DrawOp::Kind::RECT:
+        fb->draw_rect(op.x, op.y - dy, op.w, op.h, op.colour);
+        break;
+    case DrawOp::Kind::LINE:
+        fb->draw_line(op.lx1, op.ly1 - dy, op.lx2, op.ly2 - dy, op.thickness, op.colour);
+        break;
+    case DrawOp::Kind::POLYGON:
+        fill_polygon(fb, op, dy);
+        break;
+    case DrawOp::Kind::CIRCLE:
+        fb->draw_circle(op.x, op.y - dy, op.w, /* stroke_size = */ 1, op.colour, op.filled);
+        break;
+    case DrawOp::Kind::CLIP:
+    case DrawOp::Kind::UNCLIP:
+        break;
+    }
+}
+
+// Draw ops to a layer
+static void replay(Layer * layer, const std::vector<DrawOp> & ops)
+{
+    for (auto & op : ops) {
+        if (op.kind == DrawOp::Kind::CLIP)
+            layer->clip(op.x, op.y, op.w, op.h);
+        else if (op.kind == DrawOp::Kind::UNCLIP)
+            layer->unclip();
+        else
+            replay(layer->drawfb, op, 0);
+    }
+}
+
+// Draw the rows [y0, y1) and columns [x0, x1) of dest into band (a layer
+// y1 - y0 rows high), then copy them back. Bands don't overlap, so several
+// can be drawn at once.
+static void replay_band(Layer * dest, Layer * band, const std::vector<DrawOp> & ops,
+                        int x0, int y0, int x1, int y1)
+{
+    auto copy_rows = [=](framebuffer::FB * src, int src_y, framebuffer::FB * dst, int dst_y) {
+        for (int i = 0; i < y1 - y0; i++)
+            memcpy(&dst->fbmem[(dst_y + i)*dst->width + x0],
+                   &src->fbmem[(src_y + i)*src->width + x0],
+                   (x1 - x0) * sizeof(remarkable_color));
+    };
+    copy_rows(dest->fb, y0, band->fb, 0);
+
+    // Clips are translated to the band; a clip that misses the band hides
+    // everything until the next unclip.
+    bool clipped_out = false;
+    for (auto & op : ops) {
+        if (op.kind == DrawOp::Kind::CLIP) {
+            if (band->is_clipped())
+                band->unclip();
+            int clip_y0 = std::max(op.y, y0);
+            int clip_y1 = std::min(op.y + op.h, y1);
+            clipped_out = clip_y0 >= clip_y1 || op.w <= 0;
+            if (!clipped_out)
+                band->clip(op.x, clip_y0 - y0, op.w, clip_y1 - clip_y0);
+        } else if (op.kind == DrawOp::Kind::UNCLIP) {
+            if (band->is_clipped())
+                band->unclip();
+            clipped_out = false;
+        } else if (!clipped_out && op.y0 < y1 && op.y1 > y0) {
+            replay(band->drawfb, op, y0);
+        }
+    }
+    if (band->is_clipped())
+        band->unclip();
+
+    copy_rows(band->fb, 0, dest->fb, y0);
+}
+
+// Threads used for banded drawing. The UI thread draws one band itself, so
+// this is one less than the number of cores.
+static WorkQueue & band_queue()
+{
+    static WorkQueue queue(std::max(1, (int)std::thread::hardware_concurrency() - 1));
+    return queue;
+}
+
+void PuzzleDrawer::start_draw()
+{
+    alloc_phase_begin(fe->ourgame, AllocPhase::REDRAW);
+    recording = true;
+}
+
+void PuzzleDrawer::end_draw()
+{
+    flush();
+    recording = false;
+    target = 0;
+    alloc_phase_end();
+}
+
+void PuzzleDrawer::submit(DrawOp && op)
+{
+    op_counts[(int)op.kind]++;
+    if (recording) {
+        ops.push_back(std::move(op));
+    } else {
+        Layer * layer = canvas->layer(target);
+        if (op.kind == DrawOp::Kind::CLIP)
+            layer->clip(op.x, op.y, op.w, op.h);
+        else if (op.kind == DrawOp::Kind::UNCLIP)
+            layer->unclip();
+        else
+            replay(layer->drawfb, op, 0);
+    }
+}
+
+void PuzzleDrawer::flush()
+{
+    if (ops.empty())
+        return;
+    Layer * layer = canvas->layer(target);
+    auto fb = layer->fb;
+
+    // Area touched by this batch
+    int x0 = INT_MAX, y0 = INT_MAX, x1 = INT_MIN, y1 = INT_MIN;
+    for (auto & op : ops) {
+        if (op.kind == DrawOp::Kind::CLIP || op.kind == DrawOp::Kind::UNCLIP)
+            continue;
+        x0 = std::min(x0, op.x0); y0 = std::min(y0, op.y0);
+        x1 = std::max(x1, op.x1); y1 = std::max(y1, op.y1);
+    }
+    x0 = std::max(x0, 0); y0 = std::max(y0, 0);
+    x1 = std::min(x1, fb->width); y1 = std::min(y1, fb->height);
+
+    // Only frames that are tall enough are worth handing to other threads
+    int nbands = fe->config.render_bands;
+    // One band per core: on a single core, banding is pure overhead
+    if (nbands <= 0)
+        nbands = std::max(1, (int)std::thread::hardware_concurrency());
+    nbands = std::min(nbands, (y1 - y0) / MIN_BAND_HEIGHT);
+    if (nbands <= 1 || layer->is_clipped() || x0 >= x1) {
+        replay(layer, ops);
+        ops.clear();
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    int band_h = ((y1 - y0 + nbands - 1) / nbands + 15) & ~15;
+    if ((int)band_layers.size() != nbands || band_layers[0]->fb->height != band_h
+            || band_layers[0]->fb->width != fb->width) {
+        band_layers.clear();
+        for (int i = 0; i < nbands; i++)
+            band_layers.emplace_back(new Layer(fb->width, band_h));
+    }
+    for (int i = nbands - 1; i >= 0; i--) {
+        Layer * band = band_layers[i].get();
+        int band_y0 = y0 + i * band_h;
+        int band_y1 = std::min(y1, band_y0 + band_h);
+        if (band_y0 >= band_y1)
+            continue;
+        if (i == 0)
+            replay_band(layer, band, ops, x0, band_y0, x1, band_y1);
+        else
+            band_queue().add([=]() { replay_band(layer, band, ops, x0, band_y0, x1, band_y1); });
+    }
+    band_queue().wait();
+
+    fb->update_dirty(fb->dirty_area, x0, y0);
+    fb->update_dirty(fb->dirty_area, x1, y1);
+    fb->dirty = 1;
+
+    // Bands only clip themselves. If a clip is still open (we're flushing
+    // mid-frame for a blitter), apply it to the layer, so the rest of the
+    // frame is clipped and its unclip has something to undo.
+    const DrawOp * open_clip = NULL;
+    for (auto & op : ops) {
+        if (op.kind == DrawOp::Kind::CLIP)
+            open_clip = &op;
+        else if (op.kind == DrawOp::Kind::UNCLIP)
+            open_clip = NULL;
+    }
+    if (open_clip != NULL)
+        layer->clip(open_clip->x, open_clip->y, open_clip->w, open_clip->h);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    debugf("drew %zu ops in %d bands: %.1f ms\n", ops.size(), nbands,
+           std::chrono::duration<float, std::milli>(elapsed).count());
+    ops.clear();
+}
+
+// == Drawing functions ==
+
+void PuzzleDrawer::draw_text(int x, int y, int fonttype,
+                             int fontsize, int align, int colour,
+                             const char *text)
+{
+    // Render text to a bitmap (from ui/util)
+    remarkable_color c = rm_color(colour);
+    remarkable_color alpha = c == WHITE ? BLACK : WHITE;
+    image_data image = render_colored_text(text, fontsize, rm_color(colour));
+
+    // Align the text
+    // fontsize should be close to the height (in pixels) of the text.
+    if (align & ALIGN_VNORMAL) {
+        y -= fontsize;
+    } else if (align  & ALIGN_VCENTRE) {
+        y -= fontsize / 2;
+    }
+    if (align & ALIGN_HCENTRE) {
+        x -= image.w / 2;
+    } else if (align & ALIGN_HRIGHT) {
+        x -= image.w;
+    }
+
+    // Actually draw the bitmap
+    DrawOp op(DrawOp::Kind::BITMAP);
+    op.x = op.x0 = x;
+    op.y = op.y0 = y;
+    op.x1 = x + image.w;
+    op.y1 = y + image.h;
+    op.fill = alpha;
+    op.image = image;
+    op.image_buffer.reset(image.buffer);
+    submit(std::move(op));
+    add_content(x, y, x + image.w, y + image.h, colour);
+}
+
+void PuzzleDrawer::draw_rect(int x, int y, int w, int h, int colour)
+{
+    DrawOp op(DrawOp::Kind::RECT);
+    op.x = op.x0 = x;
+    op.y = op.y0 = y;
+    op.w = w;
+    op.h = h;
+    op.x1 = x + w;
+    op.y1 = y + h;
+    op.colour = rm_color(colour);
+    submit(std::move(op));
+    add_content(x, y, x + w, y + h, colour);
+}
+
+void PuzzleDrawer::draw_line(int x1, int y1, int x2, int y2, int colour)
+{
+    draw_thick_line(1, x1, y1, x2, y2, colour);
+}
+
+void PuzzleDrawer::draw_polygon(int *icoords, int npoints,
+                                int fillcolour, int outlinecolour)
+{
+    if (npoints <= 0)
+        return;
+    DrawOp op(DrawOp::Kind::POLYGON);
+    op.coords.assign(icoords, icoords + 2*npoints);
+    op.colour = rm_color(outlinecolour);
+    op.filled = fillcolour != -1;
+    if (op.filled)
+        op.fill = rm_color(fillcolour);
+    op.x0 = op.x1 = icoords[0];
+    op.y0 = op.y1 = icoords[1];
+    for (int i = 1; i < npoints; i++) {
+        op.x0 = std::min(op.x0, icoords[2*i]);   op.x1 = std::max(op.x1, icoords[2*i]);
+        op.y0 = std::min(op.y0, icoords[2*i+1]); op.y1 = std::max(op.y1, icoords[2*i+1]);
+    }
+    op.x1++;
+    op.y1++;
+    // outline is always drawn; fill might be
+    add_content(op.x0, op.y0, op.x1, op.y1, outlinecolour);
+    if (op.filled)
+        add_content(op.x0, op.y0, op.x1, op.y1, fillcolour);
+    submit(std::move(op));
 }
 
 void PuzzleDrawer::draw_circle(int cx, int cy, int radius,
         int fillcolour, int outlinecolour)
 {
+    add_content(cx - radius, cy - radius, cx + radius + 1, cy + radius + 1, outlinecolour);
+
+    auto circle = [&](int colour, bool fill) {
+        DrawOp op(DrawOp::Kind::CIRCLE);
+        op.x = cx;
+        op.y = cy;
+        op.w = radius;
+        op.x0 = cx - radius - 1;
+        op.y0 = cy - radius - 1;
+        op.x1 = cx + radius + 2;
+        op.y1 = cy + radius + 2;
+        op.colour = rm_color(colour);
+        op.filled = fill;
+        submit(std::move(op));
+    };
     if (fillcolour == outlinecolour) {
         // simple filled circle
-        canvas->drawfb()->draw_circle(cx, cy, radius,
-                /* stroke_size = */ 1,
-                rm_color(outlinecolour),
-                /* fill = */ true);
+        circle(outlinecolour, true);
     } else if (fillcolour == -1) {
         // outline only
-        canvas->drawfb()->draw_circle(cx, cy, radius,
-                /* stroke_size = */ 1,
-                rm_color(outlinecolour),
-                /* fill = */ false);
+        circle(outlinecolour, false);
     } else {
         // separate fill and outline colors
         // 1: draw the fill
-        canvas->drawfb()->draw_circle(cx, cy, radius,
-                /* stroke_size = */ 1,
-                rm_color(fillcolour),
-                /* fill = */ true);
+        circle(fillcolour, true);
         // 2: draw the outline
-        canvas->drawfb()->draw_circle(cx, cy, radius,
-                /* stroke_size = */ 1,
-                rm_color(outlinecolour),
-                /* fill = */ false);
+        circle(outlinecolour, false);
     }
 }
 
@@ -165,14 +425,37 @@ void PuzzleDrawer::draw_thick_line(float thickness,
         float x1, float y1, float x2, float y2,
         int colour)
 {
-    canvas->drawfb()->draw_line(x1, y1, x2, y2, thickness, rm_color(colour));
+    int t = std::ceil(thickness);
+    DrawOp op(DrawOp::Kind::LINE);
+    op.lx1 = x1; op.ly1 = y1;
+    op.lx2 = x2; op.ly2 = y2;
+    op.thickness = thickness;
+    op.colour = rm_color(colour);
+    op.x0 = std::floor(std::min(x1, x2)) - t;
+    op.y0 = std::floor(std::min(y1, y2)) - t;
+    op.x1 = std::ceil(std::max(x1, x2)) + t + 1;
+    op.y1 = std::ceil(std::max(y1, y2)) + t + 1;
+    submit(std::move(op));
+    add_content(op.x0, op.y0, op.x1, op.y1, colour);
+}
+
+void PuzzleDrawer::clip(int x, int y, int w, int h)
+{
+    DrawOp op(DrawOp::Kind::CLIP);
+    op.x = x; op.y = y; op.w = w; op.h = h;
+    submit(std::move(op));
+}
+
+void PuzzleDrawer::unclip()
+{
+    submit(DrawOp(DrawOp::Kind::UNCLIP));
 }
 
 void PuzzleDrawer::draw_update(int x, int y, int w, int h)
 {
     canvas->dirty = 1;
-    canvas->drawfb()->update_dirty(canvas->drawfb()->dirty_area, x, y);
-    canvas->drawfb()->update_dirty(canvas->drawfb()->dirty_area, x+w, y+h);
+    target_fb()->update_dirty(target_fb()->dirty_area, x, y);
+    target_fb()->update_dirty(target_fb()->dirty_area, x+w, y+h);
 }
 
 
@@ -181,6 +464,7 @@ void PuzzleDrawer::draw_update(int x, int y, int w, int h)
 struct blitter {
     std::vector<remarkable_color> buffer;
     int x, y, w, h;
+    bool overlay = false; // the saved area is whatever's under the overlay
     blitter(int w, int h) : x(0), y(0), w(w), h(h) {}
 };
 
@@ -208,14 +492,23 @@ void clamp_length(int &pt, int &len, int max_len)
 
 void PuzzleDrawer::blitter_save(blitter *bl, int x, int y)
 {
+    flush(); // the blitter needs the pixels drawn so far
     int w = bl->w;
     int h = bl->h;
     // blitter bookkeeping
     bl->x = x;
     bl->y = y;
+    if (fe->config.drag_overlay) {
+        // No need to save anything: the rest of the frame is drawn on the
+        // overlay, leaving the base layer alone.
+        bl->overlay = true;
+        canvas->overlay(); // created on first use
+        target = 1;
+        return;
+    }
     bl->buffer.resize(bl->w * bl->h);
     // do the actual copy
-    auto fb = canvas->drawfb();
+    auto fb = target_fb();
     clamp_length(x, w, fb->width);
     clamp_length(y, h, fb->height);
     for (int i = 0; i < h; i++) {
@@ -226,16 +519,23 @@ void PuzzleDrawer::blitter_save(blitter *bl, int x, int y)
 
 void PuzzleDrawer::blitter_load(blitter *bl, int x, int y)
 {
+    flush(); // anything drawn before this goes underneath
     int w = bl->w;
     int h = bl->h;
     if (x == BLITTER_FROMSAVED) x = bl->x;
     if (y == BLITTER_FROMSAVED) y = bl->y;
+    if (bl->overlay) {
+        canvas->overlay()->clear(x, y, w, h);
+        canvas->dirty = 1;
+        return;
+    }
     // do the actual copy
-    auto fb = canvas->drawfb();
+    auto fb = target_fb();
     clamp_length(x, w, fb->width);
     clamp_length(y, h, fb->height);
     for (int i = 0; i < h; i++) {
         auto bl_start = bl->buffer.begin() + i*bl->w;
         std::copy(bl_start, bl_start + w, &fb->fbmem[(y+i)*fb->width + x]);
     }
+    add_content(x, y, x + w, y + h);
 }
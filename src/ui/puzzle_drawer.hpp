@@ -1,9 +1,36 @@
 #ifndef RMP_UI_PUZZLE_DRAWER_HPP
 #define RMP_UI_PUZZLE_DRAWER_HPP
 
+#include <array>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
 #include "puzzles.hpp"
 #include "ui/canvas.hpp"
 
+// A drawing operation recorded during a frame, with colors already resolved
+// and text already rendered, so it can be replayed on any thread.
+struct DrawOp {
+    enum class Kind { BITMAP, RECT, LINE, POLYGON, CIRCLE, CLIP, UNCLIP };
+    static const int NUM_KINDS = 7;
+    Kind kind;
+    // Bounds of the pixels touched (unused for CLIP and UNCLIP)
+    int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+    // RECT, CLIP: rect; CIRCLE: center (x, y) and radius (w); BITMAP: x, y
+    int x = 0, y = 0, w = 0, h = 0;
+    // LINE
+    float lx1 = 0, ly1 = 0, lx2 = 0, ly2 = 0, thickness = 1;
+    // POLYGON: colour is the outline; BITMAP: fill is the alpha color
+    remarkable_color colour = 0, fill = 0;
+    bool filled = false;
+    std::vector<int> coords;
+    image_data image;
+    std::unique_ptr<void, void (*)(void *)> image_buffer { nullptr, free };
+
+    DrawOp(Kind kind) : kind(kind) {}
+};
+
 class PuzzleDrawer : public DrawingApi
 {
 public:
@@ -11,10 +38,19 @@ public:
 
     PuzzleDrawer(Canvas * canvas) : DrawingApi(), canvas(canvas)
     {
-        canvas->drawfb()->dither = framebuffer::DITHER::BAYER_2;
+        canvas->dither = true;
     }
     ~PuzzleDrawer() {}
 
+    // Clear the canvas (and its content bounds)
+    void clear() { canvas->layer(0)->clear(); }
+
+    // Number of drawing operations of each DrawOp::Kind so far
+    std::array<long, DrawOp::NUM_KINDS> op_counts {};
+
+    void start_draw();
+    void end_draw();
+
     void draw_text(int x, int y, int fonttype,
                    int fontsize, int align, int colour,
                    const char *text);
@@ -29,8 +65,8 @@ public:
 
     void draw_update(int x, int y, int w, int h);
 
-    void clip(int x, int y, int w, int h) { canvas->clip(x, y, w, h); }
-    void unclip() { canvas->unclip(); }
+    void clip(int x, int y, int w, int h);
+    void unclip();
 
     blitter * blitter_new(int w, int h);
     void blitter_free(blitter *bl);
@@ -38,7 +74,28 @@ public:
     void blitter_load(blitter *bl, int x, int y);
 
 protected:
+    // Canvas layer that drawing currently goes to. With drag_overlay set in
+    // the config, anything drawn after a blitter_save (until the end of the
+    // frame) is drawn on the canvas overlay, and loading that blitter just
+    // clears the overlay. This suits games that use a blitter to draw the
+    // piece being dragged (e.g. Pegs).
+    int target = 0;
+    framebuffer::FB * target_fb() { return canvas->drawfb(target); }
+
+    // Between start_draw and end_draw, drawing is recorded and rasterised
+    // when the frame ends (or before a blitter needs the pixels). Large
+    // frames are split into horizontal bands, which are rasterised in
+    // parallel (see Config::render_bands).
+    static const int MIN_BAND_HEIGHT = 64;
+    bool recording = false;
+    std::vector<DrawOp> ops;
+    std::vector<std::unique_ptr<Layer>> band_layers;
+    void submit(DrawOp && op);
+    void flush();
+
     remarkable_color rm_color(int idx);
+    // Grow the canvas's content bounds, unless this only drew white
+    void add_content(int x0, int y0, int x1, int y1, int colour = -1);
 };
 
 #endif // RMP_UI_PUZZLE_DRAWER_HPP
@@ -0,0 +1,70 @@
+#ifndef RMP_SOLVE_DIALOG_HPP
+#define RMP_SOLVE_DIALOG_HPP
+
+#include <string>
+
+#include <rmkit.h>
+
+// Shown while a slow solve runs in the background
+class SolveDialog : public ui::DialogBase {
+public:
+    ui::Text * label_text;
+    ui::Button * cancel_btn;
+
+    SolveDialog(int w, int h) : ui::DialogBase(0, 0, w, h)
+    {
+        label_text = new ui::Text(0, 0, w, h - 100, "");
+        label_text->set_style(ui::Stylesheet()
+                              .justify_center()
+                              .valign_middle()
+                              .font_size(50));
+
+        cancel_btn = new ui::Button(0, 0, w, 100, "Cancel");
+        cancel_btn->set_style(ui::Stylesheet().border_all());
+    }
+
+    void build_dialog()
+    {
+        ui::Scene scene = create_scene();
+        auto v = ui::VerticalLayout(x, y, w, h, scene);
+        v.pack_start(label_text);
+        v.pack_end(cancel_btn);
+    }
+
+    void show()
+    {
+        seconds = 0;
+        update_label();
+        // Tick so it's clear that something is still happening
+        timer = ui::set_interval([=]() {
+            seconds++;
+            update_label();
+        }, 1000);
+        ui::DialogBase::show();
+    }
+
+    void hide()
+    {
+        if (timer) {
+            ui::cancel_timer(timer);
+            timer = nullptr;
+        }
+        if (scene && ui::MainLoop::overlay_is_visible(scene))
+            ui::MainLoop::hide_overlay(scene);
+    }
+
+protected:
+    ui::TimerPtr timer;
+    int seconds = 0;
+
+    void update_label()
+    {
+        label_text->undraw();
+        label_text->text = "Solving...";
+        if (seconds > 0)
+            label_text->text += " " + std::to_string(seconds) + "s";
+        label_text->dirty = 1;
+    }
+};
+
+#endif // RMP_SOLVE_DIALOG_HPP
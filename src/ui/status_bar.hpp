@@ -0,0 +1,160 @@
+#ifndef RMP_STATUS_BAR_HPP
+#define RMP_STATUS_BAR_HPP
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <rmkit.h>
+
+#include "ui/util.hpp"
+
+// One line of left-aligned text that is redrawn incrementally. Timed games
+// update the status every tick, so rather than clearing and re-rendering the
+// whole line, set_text only redraws the characters that changed (from a
+// cache of rendered glyphs) and refreshes just that strip with a fast
+// waveform.
+//
+// Characters are laid out one after another by their glyph widths, without
+// kerning.
+class StatusBar : public ui::Widget {
+public:
+    std::string text;
+
+    StatusBar(int x, int y, int w, int h) : ui::Widget(x, y, w, h) {}
+
+    ~StatusBar()
+    {
+        for (auto & kv : glyphs)
+            free(kv.second.buffer);
+    }
+
+    void set_text(const std::string & new_text)
+    {
+        if (new_text == text)
+            return;
+        text = new_text;
+        if (!drawn || !visible || !ui::MainLoop::is_visible(this)
+                || ui::MainLoop::overlay_is_visible()) {
+            dirty = 1; // full render when we're next shown
+            return;
+        }
+        update();
+    }
+
+    // Full render (first show, or something drew over us)
+    void render()
+    {
+        fb->draw_rect(x, y, w, h, WHITE);
+        cells = layout(text);
+        for (auto & cell : cells)
+            draw_cell(cell);
+        drawn = true;
+    }
+
+    void undraw()
+    {
+        ui::Widget::undraw();
+        drawn = false;
+    }
+
+protected:
+    struct Cell {
+        std::string glyph; // one UTF-8 character
+        int x, w;
+    };
+
+    std::map<std::string, image_data> glyphs;
+    std::vector<Cell> cells; // as drawn
+    bool drawn = false;
+
+    image_data & glyph(const std::string & ch)
+    {
+        auto it = glyphs.find(ch);
+        if (it == glyphs.end())
+            it = glyphs.emplace(ch, render_colored_text(ch.c_str(), style.font_size, BLACK)).first;
+        return it->second;
+    }
+
+    std::vector<Cell> layout(const std::string & str)
+    {
+        std::vector<Cell> out;
+        int cx = 0;
+        for (size_t i = 0; i < str.size(); ) {
+            size_t len = 1;
+            while (i + len < str.size() && (str[i + len] & 0xC0) == 0x80)
+                len++; // UTF-8 continuation byte
+            std::string ch = str.substr(i, len);
+            int cw = glyph(ch).w;
+            if (cx + cw > w)
+                break;
+            out.push_back({ ch, cx, cw });
+            cx += cw;
+            i += len;
+        }
+        return out;
+    }
+
+    void draw_cell(const Cell & cell)
+    {
+        image_data & image = glyph(cell.glyph);
+        fb->draw_bitmap(image, x + cell.x, y + (h - image.h) / 2, WHITE);
+    }
+
+    // Redraw only the cells that differ from what's on screen
+    void update()
+    {
+        std::vector<Cell> new_cells = layout(text);
+
+        // Span (in x) of every cell that isn't identical in both layouts
+        int x0 = w, x1 = 0;
+        size_t n = std::max(cells.size(), new_cells.size());
+        for (size_t i = 0; i < n; i++) {
+            const Cell * a = i < cells.size() ? &cells[i] : nullptr;
+            const Cell * b = i < new_cells.size() ? &new_cells[i] : nullptr;
+            if (a && b && a->glyph == b->glyph && a->x == b->x)
+                continue;
+            for (const Cell * c : { a, b }) {
+                if (c) {
+                    x0 = std::min(x0, c->x);
+                    x1 = std::max(x1, c->x + c->w);
+                }
+            }
+        }
+        cells = new_cells;
+        if (x0 >= x1)
+            return;
+        // Redraw whole cells, so widen the span to cell boundaries
+        for (auto & cell : cells) {
+            if (cell.x < x1 && cell.x + cell.w > x0) {
+                x0 = std::min(x0, cell.x);
+                x1 = std::max(x1, cell.x + cell.w);
+            }
+        }
+
+        // If nothing else is waiting to be refreshed, refresh just this
+        // strip right away; otherwise it goes out with everything else.
+        bool refresh_now = !fb->dirty;
+        fb->draw_rect(x + x0, y, x1 - x0, h, WHITE);
+        for (auto & cell : cells)
+            if (cell.x >= x0 && cell.x + cell.w <= x1)
+                draw_cell(cell);
+        if (refresh_now) {
+            auto old_waveform = fb->waveform_mode;
+            auto old_update = fb->update_mode;
+            fb->dirty_area.x0 = x + x0;
+            fb->dirty_area.y0 = y;
+            fb->dirty_area.x1 = x + x1;
+            fb->dirty_area.y1 = y + h;
+            fb->dirty = 1;
+            fb->waveform_mode = WAVEFORM_MODE_DU;
+            fb->update_mode = UPDATE_MODE_PARTIAL;
+            fb->redraw_screen();
+            fb->waveform_mode = old_waveform;
+            fb->update_mode = old_update;
+        }
+    }
+};
+
+#endif // RMP_STATUS_BAR_HPP
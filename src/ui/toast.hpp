@@ -30,6 +30,7 @@ public:
         if (timer)
             ui::cancel_timer(timer);
         timer = ui::set_timeout([=]() {
+            timer = nullptr;
             if (visible && ui::MainLoop::is_visible(this)) {
                 hide();
                 fb->draw_rect(last_x, last_y, last_w, last_h, WHITE);
@@ -43,6 +44,16 @@ public:
         ui::Widget::show();
     }
 
+    void hide()
+    {
+        // Don't wake up later just to hide again
+        if (timer) {
+            ui::cancel_timer(timer);
+            timer = nullptr;
+        }
+        ui::Widget::hide();
+    }
+
     void render()
     {
         auto old_dither = fb->dither;
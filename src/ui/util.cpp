@@ -1,14 +1,22 @@
 #include "util.hpp"
 
+#include <mutex>
+
 #include <rmkit.h>
 
 image_data render_colored_text(const char * text, int font_size, remarkable_color color)
 {
     // Render text to a bitmap -- taken from Framebuffer::draw_text()
-    image_data image = stbtext::get_text_size(text, font_size);
-    image.buffer = (uint32_t*) malloc(sizeof(uint32_t) * image.w * image.h);
-    memset(image.buffer, WHITE, sizeof(uint32_t) * image.w * image.h);
-    stbtext::render_text(text, image, font_size);
+    image_data image;
+    {
+        // stbtext shares its font state (icons are drawn on several threads)
+        static std::mutex m;
+        std::lock_guard<std::mutex> lock(m);
+        image = stbtext::get_text_size(text, font_size);
+        image.buffer = (uint32_t*) malloc(sizeof(uint32_t) * image.w * image.h);
+        memset(image.buffer, WHITE, sizeof(uint32_t) * image.w * image.h);
+        stbtext::render_text(text, image, font_size);
+    }
 
     // color in the text (render_text renders as black);
     remarkable_color alpha = color == WHITE ? BLACK : WHITE;
@@ -0,0 +1,102 @@
+#ifndef RMP_WORKER_HPP
+#define RMP_WORKER_HPP
+
+// Background threads for work that shouldn't block the UI (file I/O, etc).
+//
+// Anything run on a WorkQueue must not touch rmkit widgets or the display
+// framebuffer; use run_on_ui_thread to hand results back to the main loop.
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <rmkit.h>
+
+class WorkQueue {
+public:
+    WorkQueue(int nthreads = 1)
+    {
+        for (int i = 0; i < std::max(1, nthreads); i++)
+            threads.emplace_back([=]() { run(); });
+    }
+
+    ~WorkQueue()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            stopping = true;
+        }
+        cv.notify_all();
+        for (auto & t : threads)
+            t.join();
+    }
+
+    int size() const { return threads.size(); }
+
+    void add(std::function<void()> fn)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            tasks.push_back(fn);
+        }
+        cv.notify_one();
+    }
+
+    // Block until every queued task has finished
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(m);
+        idle_cv.wait(lock, [=]() { return tasks.empty() && busy == 0; });
+    }
+
+private:
+    std::vector<std::thread> threads;
+    std::deque<std::function<void()>> tasks;
+    std::mutex m;
+    std::condition_variable cv;
+    std::condition_variable idle_cv;
+    int busy = 0;
+    bool stopping = false;
+
+    void run()
+    {
+        while (true) {
+            std::function<void()> fn;
+            {
+                std::unique_lock<std::mutex> lock(m);
+                cv.wait(lock, [=]() { return stopping || !tasks.empty(); });
+                if (tasks.empty())
+                    return; // stopping, and nothing left to do
+                fn = std::move(tasks.front());
+                tasks.pop_front();
+                busy++;
+            }
+            fn();
+            {
+                std::lock_guard<std::mutex> lock(m);
+                busy--;
+            }
+            idle_cv.notify_all();
+        }
+    }
+};
+
+// Single background thread shared by the app for saving files. Tasks run in
+// the order they were added, so a later save of the same file always wins.
+inline WorkQueue & background_queue()
+{
+    static WorkQueue queue(1);
+    return queue;
+}
+
+// Run fn on the UI thread at the next iteration of the main loop.
+inline void run_on_ui_thread(std::function<void()> fn)
+{
+    ui::TaskQueue::add_task(fn);
+}
+
+#endif // RMP_WORKER_HPP